@@ -0,0 +1,220 @@
+#include <benchmark/benchmark.h>
+
+#define UNIT_TESTS 1
+#include "../device.cpp"
+
+// ---------- Stream ----------
+static void BM_StreamSetGet(benchmark::State& state) {
+    Stream s(1);
+    double x = 0.0;
+    for (auto _ : state) {
+        s.setMassFlow(x);
+        x = s.getMassFlow() + 1.0;
+        benchmark::DoNotOptimize(x);
+    }
+}
+BENCHMARK(BM_StreamSetGet);
+
+// ---------- Mixer ----------
+static void BM_MixerUpdate(benchmark::State& state) {
+    const int inputs = static_cast<int>(state.range(0));
+    Mixer mx(inputs);
+    for (int i = 0; i < inputs; i++) {
+        auto s = std::make_shared<Stream>(i + 1);
+        s->setMassFlow(1.0 + i);
+        mx.addInput(s);
+    }
+    auto out = std::make_shared<Stream>(inputs + 1);
+    mx.addOutput(out);
+    for (auto _ : state) {
+        mx.updateOutputs();
+        benchmark::DoNotOptimize(out->getMassFlow());
+    }
+    state.SetItemsProcessed(state.iterations() * inputs);
+}
+BENCHMARK(BM_MixerUpdate)->RangeMultiplier(4)->Range(2, 512);
+
+// ---------- Reactor ----------
+static void BM_ReactorUpdate(benchmark::State& state) {
+    const bool isDouble = state.range(0) == 2;
+    Reactor rx(isDouble);
+    auto in = std::make_shared<Stream>(1);
+    in->setMassFlow(10.0);
+    rx.addInput(in);
+    auto o1 = std::make_shared<Stream>(2);
+    rx.addOutput(o1);
+    if (isDouble) rx.addOutput(std::make_shared<Stream>(3));
+    for (auto _ : state) {
+        rx.updateOutputs();
+        benchmark::DoNotOptimize(o1->getMassFlow());
+    }
+}
+BENCHMARK(BM_ReactorUpdate)->Arg(1)->Arg(2);
+
+// ---------- Flowsheet ----------
+// Синтетическая ациклическая схема заданного размера из FlowsheetGenerator.
+static GeneratedFlowsheet buildSyntheticFlowsheet(Flowsheet& fs, size_t deviceCount, double recycleDensity = 0.0) {
+    GeneratorOptions opt;
+    opt.devices = deviceCount;
+    opt.depth = 50;
+    opt.recycleDensity = recycleDensity;
+    return FlowsheetGenerator(opt).generate(fs);
+}
+
+static void BM_FlowsheetRun(benchmark::State& state) {
+    Flowsheet fs;
+    buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+    fs.schedule();
+    for (auto _ : state) {
+        fs.run();
+    }
+    state.SetItemsProcessed(state.iterations() * fs.getDevices().size());
+}
+BENCHMARK(BM_FlowsheetRun)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+static void BM_FlowsheetTypedTable(benchmark::State& state) {
+    Flowsheet fs;
+    buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+    StreamTable table;
+    fs.loadTable(table);
+    TypedSchedule ts;
+    ts.build(fs);
+    for (auto _ : state) {
+        ts.runTable(fs, table.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * fs.getDevices().size());
+}
+BENCHMARK(BM_FlowsheetTypedTable)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+static void BM_FlowsheetBuild(benchmark::State& state) {
+    for (auto _ : state) {
+        Flowsheet fs;
+        buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+        benchmark::DoNotOptimize(fs.getDevices().data());
+    }
+}
+BENCHMARK(BM_FlowsheetBuild)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+static void BM_FlowsheetRecycleSolve(benchmark::State& state) {
+    Flowsheet fs;
+    buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)), 0.2);
+    RecycleOptions opt;
+    opt.method = RecycleMethod::Wegstein;
+    fs.solve(opt);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fs.solve(opt).iterations);
+    }
+    state.SetItemsProcessed(state.iterations() * fs.getDevices().size());
+}
+BENCHMARK(BM_FlowsheetRecycleSolve)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMillisecond);
+
+static void BM_FlowsheetPlanExecute(benchmark::State& state) {
+    Flowsheet fs;
+    buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+    FlowsheetPlan plan;
+    if (!plan.compile(fs).empty()) {
+        state.SkipWithError("plan has errors");
+        return;
+    }
+    for (auto _ : state) {
+        plan.execute();
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * plan.stepCount());
+}
+BENCHMARK(BM_FlowsheetPlanExecute)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+// ---------- Names ----------
+static void BM_FindStreamByName(benchmark::State& state) {
+    Flowsheet fs;
+    buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+    std::vector<std::string> tags;
+    for (size_t i = 0; i < 1024; i++) tags.push_back(fs.getStreams()[(i * 7919) % fs.getStreams().size()]->getName());
+    fs.findStream(tags[0]);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fs.findStream(tags[i++ & 1023]));
+    }
+}
+BENCHMARK(BM_FindStreamByName)->Arg(1000)->Arg(1000000);
+
+// ---------- Snapshots ----------
+static void BM_SnapshotOpen(benchmark::State& state) {
+    const std::string path = "device_bench_" + std::to_string(state.range(0)) + ".snap";
+    {
+        Flowsheet fs;
+        buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+        FlowsheetSnapshot::write(fs, path);
+    }
+    for (auto _ : state) {
+        FlowsheetSnapshot snap(path);
+        benchmark::DoNotOptimize(snap.data());
+    }
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_SnapshotOpen)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+// ---------- Text format ----------
+static void BM_TextRead(benchmark::State& state) {
+    std::string text;
+    {
+        Flowsheet fs;
+        buildSyntheticFlowsheet(fs, static_cast<size_t>(state.range(0)));
+        std::ostringstream os;
+        writeFlowsheetText(fs, os);
+        text = os.str();
+    }
+    for (auto _ : state) {
+        Flowsheet fs;
+        std::istringstream in(text);
+        benchmark::DoNotOptimize(FlowsheetTextReader(fs).read(in));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_TextRead)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// ---------- Dynamic simulation ----------
+static void BM_DynamicTankChainHour(benchmark::State& state) {
+    Flowsheet fs;
+    StreamId prev = fs.newStream(1.0);
+    for (int64_t i = 0; i < state.range(0); i++) {
+        auto tank = std::make_shared<Tank>(1, 60.0);
+        StreamId next = fs.newStream();
+        fs.connectInput(*tank, prev);
+        fs.connectOutput(*tank, next);
+        fs.addDevice(tank);
+        prev = next;
+    }
+    DynamicSimulator sim(fs);
+    for (auto _ : state) {
+        sim.advance(3600.0);                                // час с шагом 1 с, RK4
+    }
+    state.SetItemsProcessed(state.iterations() * 3600);
+}
+BENCHMARK(BM_DynamicTankChainHour)->Arg(10)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+// ---------- Real-time loop ----------
+static void BM_RealtimeCycle(benchmark::State& state) {
+    Flowsheet fs;
+    GeneratedFlowsheet info;
+    {
+        GeneratorOptions opt;
+        opt.devices = static_cast<size_t>(state.range(0));
+        opt.depth = 50;
+        info = FlowsheetGenerator(opt).generate(fs);
+    }
+    FlowsheetPlan plan;
+    if (!plan.compile(fs).empty()) {
+        state.SkipWithError("plan has errors");
+        return;
+    }
+    RealtimeLoop loop(plan, info.feeds, info.products);
+    for (auto _ : state) {
+        loop.feeds()[0] += 1.0;
+        benchmark::DoNotOptimize(loop.cycle());
+    }
+    state.counters["worst_ns"] = loop.stats().worstNs;
+    state.counters["p99_ns"] = loop.latencyBound(0.99);
+}
+BENCHMARK(BM_RealtimeCycle)->Arg(1000)->Arg(10000);
@@ -2,7 +2,50 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <new>
 #include <cmath>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string_view>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <typeinfo>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+#include <fstream>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define DEVICE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define DEVICE_HAS_TSC 1
+#endif
 
 using namespace std;
 
@@ -12,40 +55,388 @@ const int MIXER_OUTPUTS = 1;
 const float POSSIBLE_ERROR = 0.01;
 
 
+const size_t COMPONENT_ALIGNMENT = 32; ///< Выравнивание покомпонентных массивов (ширина регистра AVX).
+
+#if defined(DEVICE_PROFILING)
+const bool PROFILING_ENABLED = true;  ///< Собрано ли со статистикой пересчётов устройств.
+#else
+const bool PROFILING_ENABLED = false; ///< Собрано ли со статистикой пересчётов устройств.
+#endif
+
+
+/**
+ * @class AlignedAllocator
+ * @brief Аллокатор, выравнивающий блок на @p Align байт, для векторной обработки покомпонентных массивов.
+ */
+template <class T, size_t Align>
+class AlignedAllocator
+{
+public:
+    using value_type = T;
+    template <class U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator() = default;
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), align_val_t(Align))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, align_val_t(Align)); }
+
+    template <class U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+using ComponentVector = vector<double, AlignedAllocator<double, COMPONENT_ALIGNMENT>>; ///< Покомпонентные расходы.
+
+
+/**
+ * @brief Покомпонентно прибавляет @p x к @p acc.
+ * @param acc Накопитель, @p n элементов.
+ * @param x Слагаемое, @p n элементов.
+ * @param n Число компонентов.
+ */
+inline void addComponents(double* acc, const double* x, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(acc + i, _mm256_add_pd(_mm256_loadu_pd(acc + i), _mm256_loadu_pd(x + i)));
+    }
+#endif
+    for (; i < n; i++) acc[i] += x[i];
+}
+
+/**
+ * @brief Записывает в @p out покомпонентное произведение @p x на число @p k.
+ * @param out Результат, @p n элементов; может совпадать с @p x.
+ * @param x Исходный массив, @p n элементов.
+ * @param k Множитель.
+ * @param n Число компонентов.
+ */
+inline void scaleComponents(double* out, const double* x, double k, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d vk = _mm256_set1_pd(k);
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), vk));
+    }
+#endif
+    for (; i < n; i++) out[i] = x[i] * k;
+}
+
+/**
+ * @brief Прибавляет к @p x строку стехиометрической матрицы @p nu, умноженную на степень полноты @p a.
+ * @param x Покомпонентные расходы, @p n элементов.
+ * @param nu Массовые стехиометрические коэффициенты реакции, @p n элементов.
+ * @param a Степень полноты реакции.
+ * @param n Число компонентов.
+ */
+inline void axpyComponents(double* x, const double* nu, double a, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d va = _mm256_set1_pd(a);
+    for (; i + 4 <= n; i += 4) {
+#if defined(__FMA__)
+        _mm256_storeu_pd(x + i, _mm256_fmadd_pd(_mm256_loadu_pd(nu + i), va, _mm256_loadu_pd(x + i)));
+#else
+        _mm256_storeu_pd(x + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_mul_pd(_mm256_loadu_pd(nu + i), va)));
+#endif
+    }
+#endif
+    for (; i < n; i++) x[i] += a * nu[i];
+}
+
+
+/**
+ * @class NamePool
+ * @brief Пул интернированных строк: каждое имя хранится один раз и адресуется 32-битным номером.
+ *
+ * Строки лежат в блоках, каждый следующий вдвое больше предыдущего; блоки не
+ * перемещаются и не освобождаются до разрушения пула. Поэтому @ref get можно
+ * вызывать без блокировки одновременно с @ref intern из другого потока;
+ * сами @ref intern и @ref find должны быть взаимно исключены.
+ */
+class NamePool
+{
+private:
+    static const size_t FIRST_CHUNK = 1024; ///< Размер первого блока.
+    static const size_t CHUNKS = 22;        ///< Блоков хватает на 1024·(2^22 − 1) > 2^31 строк.
+
+    array<atomic<string*>, CHUNKS> chunks{};    ///< Блоки строк; блок k вмещает FIRST_CHUNK·2^k строк.
+    atomic<uint32_t> count{0};                  ///< Число опубликованных строк.
+    unordered_map<string_view, uint32_t> index; ///< Поиск номера по строке; ключи ссылаются на строки блоков.
+
+    /**
+     * @brief Блок и позиция в нём для номера @p id.
+     */
+    static pair<size_t, size_t> locate(uint32_t id) {
+        size_t v = id / FIRST_CHUNK + 1, k = 0;
+        while (v > 1) { v >>= 1; k++; }
+        return {k, id - FIRST_CHUNK * ((size_t(1) << k) - 1)};
+    }
+
+public:
+    NamePool() = default;
+    NamePool(const NamePool&) = delete;
+    NamePool& operator=(const NamePool&) = delete;
+
+    ~NamePool() {
+        for (auto& c : chunks) delete[] c.load();
+    }
+
+    /**
+     * @brief Возвращает номер строки, добавляя её в пул при первом обращении.
+     * @param s Интернируемая строка.
+     * @throw std::string Если пул переполнен (2^31 строк).
+     */
+    uint32_t intern(string_view s) {
+        auto it = index.find(s);
+        if (it != index.end()) return it->second;
+        const uint32_t id = count.load(memory_order_relaxed);
+        if (id >= (uint32_t(1) << 31)) throw "Name pool is full"s;
+        auto [k, i] = locate(id);
+        string* chunk = chunks[k].load(memory_order_relaxed);
+        if (!chunk) {
+            chunk = new string[FIRST_CHUNK << k];
+            chunks[k].store(chunk, memory_order_release);
+        }
+        chunk[i] = s;
+        index.emplace(chunk[i], id);
+        count.store(id + 1, memory_order_release);
+        return id;
+    }
+
+    /**
+     * @brief Ищет строку, не добавляя её.
+     * @param s Строка.
+     * @return Номер строки либо UINT32_MAX, если её нет в пуле.
+     */
+    uint32_t find(string_view s) const {
+        auto it = index.find(s);
+        return it == index.end() ? UINT32_MAX : it->second;
+    }
+
+    /**
+     * @brief Возвращает строку по номеру; не требует блокировки.
+     * @param id Номер, полученный из @ref intern.
+     * @throw std::out_of_range Если такого номера нет.
+     */
+    const string& get(uint32_t id) const {
+        if (id >= count.load(memory_order_acquire)) throw out_of_range("Unknown name id");
+        auto [k, i] = locate(id);
+        return chunks[k].load(memory_order_acquire)[i];
+    }
+
+    /**
+     * @brief Количество различных строк в пуле.
+     */
+    size_t size() const { return count.load(memory_order_acquire); }
+};
+
+
+/**
+ * @class GlobalNames
+ * @brief Общий для всей программы пул явно заданных имён потоков и устройств.
+ *
+ * Добавление и поиск защищены мьютексом, а чтение имени по номеру (@ref get)
+ * выполняется без блокировки. Строки пула не перемещаются, поэтому ссылка из
+ * @ref get действительна до конца программы. Номер 0 — пустое имя. Номера со
+ * старшим битом @ref NUMBERED в пул не попадают: это имена по умолчанию
+ * «s<номер>», которые формирует @ref format.
+ */
+class GlobalNames
+{
+private:
+    static NamePool& pool() {
+        static NamePool p;
+        static const uint32_t empty = p.intern("");
+        (void)empty;
+        return p;
+    }
+
+    static mutex& lock() {
+        static mutex m;
+        return m;
+    }
+
+public:
+    static constexpr uint32_t NUMBERED = uint32_t(1) << 31; ///< Признак имени по умолчанию; младшие биты — номер.
+
+    /**
+     * @brief Номер имени; имя добавляется в пул при первом обращении.
+     */
+    static uint32_t intern(string_view s) {
+        lock_guard<mutex> guard(lock());
+        return pool().intern(s);
+    }
+
+    /**
+     * @brief Номер имени без добавления; UINT32_MAX, если такого имени нет.
+     */
+    static uint32_t find(string_view s) {
+        lock_guard<mutex> guard(lock());
+        return pool().find(s);
+    }
+
+    /**
+     * @brief Имя из пула по номеру, без блокировки.
+     * @param id Номер без признака @ref NUMBERED.
+     */
+    static const string& get(uint32_t id) {
+        return pool().get(id);
+    }
+
+    /**
+     * @brief Имя по номеру, включая имена по умолчанию с признаком @ref NUMBERED.
+     */
+    static string format(uint32_t id) {
+        if (id & NUMBERED) return "s" + to_string(id & ~NUMBERED);
+        return get(id);
+    }
+
+    /**
+     * @brief Обратное к @ref format для имён по умолчанию.
+     * @return Номер с признаком @ref NUMBERED, если @p s имеет вид «s<номер>»
+     *         без ведущих нулей, иначе 0.
+     */
+    static uint32_t numbered(string_view s) {
+        if (s.size() < 2 || s.size() > 11 || s[0] != 's' || (s[1] == '0' && s.size() > 2)) return 0;
+        uint64_t n = 0;
+        for (size_t i = 1; i < s.size(); i++) {
+            if (s[i] < '0' || s[i] > '9') return 0;
+            n = n * 10 + uint64_t(s[i] - '0');
+        }
+        return n < NUMBERED ? NUMBERED | static_cast<uint32_t>(n) : 0;
+    }
+
+    /**
+     * @brief Количество различных имён в пуле.
+     */
+    static size_t size() {
+        return pool().size();
+    }
+};
+
+
 /**
  * @class Stream
  * @brief Представляет материальный поток с именем и массовым расходом.
+ *
+ * Поток может дополнительно нести покомпонентные расходы (состав); тогда
+ * суммарный расход равен их сумме. Табличные режимы (@ref StreamTable и
+ * построенные на нём ядра) работают только с суммарным расходом.
  */
 class Stream
 {
 private:
-    double mass_flow; ///< Массовый расход потока.
-    string name;      ///< Имя потока. 
+    double mass_flow = 0.0; ///< Массовый расход потока.
+    uint64_t version = 0;   ///< Счётчик изменений расхода; растёт при каждом @ref setMassFlow.
+    ComponentVector components; ///< Покомпонентные расходы; пусто, если состав не задан.
+    uint32_t nameId = 0;        ///< Номер имени в @ref GlobalNames либо номер потока с признаком @ref GlobalNames::NUMBERED.
 
 public:
     /**
      * @brief Конструктор, создающий поток с именем вида "s<номер>".
+     *
+     * Имя не интернируется: хранится только номер, а строка формируется в @ref getName.
      * @param s Порядковый номер потока; используется для формирования имени.
      */
-    Stream(int s){setName("s"+std::to_string(s));}
+    Stream(int s){
+        if (s >= 0) nameId = GlobalNames::NUMBERED | static_cast<uint32_t>(s);
+        else setName("s"+std::to_string(s));
+    }
+
+    /**
+     * @brief Конструктор, создающий поток с заданным именем.
+     * @param name Имя потока.
+     */
+    explicit Stream(string_view name){setName(name);}
 
     /**
      * @brief Устанавливает имя потока.
      * @param s Новое имя потока.
      */
-    void setName(string s){name=s;}
+    void setName(string_view s){nameId=GlobalNames::intern(s);}
+
+    /**
+     * @brief Возвращает потоку имя по умолчанию "s<номер>" без интернирования (см. @ref Stream(int)).
+     * @param s Номер, меньший @ref GlobalNames::NUMBERED.
+     */
+    void setNumber(uint32_t s){nameId=GlobalNames::NUMBERED|s;}
 
     /**
      * @brief Возвращает имя потока.
      * @return Текущее имя.
      */
-    string getName(){return name;}
+    string getName() const {return GlobalNames::format(nameId);}
 
     /**
-     * @brief Устанавливает массовый расход потока.
+     * @brief Возвращает номер имени в @ref GlobalNames; для имени по умолчанию
+     *        в нём установлен признак @ref GlobalNames::NUMBERED.
+     */
+    uint32_t getNameId() const {return nameId;}
+
+    /**
+     * @brief Устанавливает массовый расход потока. Если состав задан, расходы
+     *        компонентов масштабируются пропорционально, чтобы их сумма осталась равна расходу.
      * @param m Значение массового расхода.
+     * @throw std::string Если состав задан, его сумма равна нулю, а @p m — нет.
+     */
+    void setMassFlow(double m){
+        if (!components.empty()) {
+            double total = 0.0;
+            for (double x : components) total += x;
+            if (total != 0.0) scaleComponents(components.data(), components.data(), m / total, components.size());
+            else if (m != 0.0) throw "Cannot scale an empty composition"s;
+        }
+        mass_flow=m; ++version;
+    }
+
+    /**
+     * @brief Делает суммарный расход равным сумме компонентов после их записи через @ref componentData.
+     */
+    void commitComponents() {
+        double total = 0.0;
+        for (double x : components) total += x;
+        mass_flow = total;
+        ++version;
+    }
+
+    /**
+     * @brief Возвращает номер версии расхода; меняется при каждом @ref setMassFlow и @ref commitComponents.
+     * @return Текущая версия.
+     */
+    uint64_t getVersion() const {return version;}
+
+    /**
+     * @brief Задаёт покомпонентные расходы; суммарный расход становится их суммой.
+     * @param c Расходы компонентов.
+     */
+    void setComponentFlows(const vector<double>& c) {
+        components.assign(c.begin(), c.end());
+        commitComponents();
+    }
+
+    /**
+     * @brief Возвращает число компонентов (0, если состав не задан).
+     */
+    size_t componentCount() const {return components.size();}
+
+    /**
+     * @brief Возвращает расход одного компонента.
+     * @param i Номер компонента.
+     */
+    double getComponentFlow(size_t i) const {return components.at(i);}
+
+    /**
+     * @brief Выровненный массив покомпонентных расходов для вычислительных ядер.
      */
-    void setMassFlow(double m){mass_flow=m;}
+    const double* componentData() const {return components.data();}
+    double* componentData() {return components.data();}
+
+    /**
+     * @brief Меняет число компонентов; при неизменном размере память не перевыделяется.
+     * @param n Новое число компонентов.
+     */
+    void resizeComponents(size_t n) {components.resize(n);}
 
     /**
      * @brief Возвращает массовый расход потока.
@@ -60,147 +451,4640 @@ public:
 };
 
 
+using StreamId = uint32_t; ///< Номер строки потока в @ref StreamTable.
+const StreamId NO_STREAM = UINT32_MAX; ///< Номер, означающий отсутствие потока.
+
+
 /**
- * @class Device
- * @brief Абстрактное устройство с набором входных и выходных потоков.
+ * @class StreamTable
+ * @brief Хранилище потоков в виде структуры массивов: расходы лежат в одном
+ *        непрерывном массиве, имена — в пуле @ref NamePool, поток адресуется номером @ref StreamId.
  */
-class Device
+class StreamTable
 {
-protected:
-    vector<shared_ptr<Stream>> inputs;  ///< Входные потоки, подключённые к устройству.
-    vector<shared_ptr<Stream>> outputs; ///< Выходные потоки, формируемые устройством.
-    int inputAmount; ///< Максимально допустимое количество входных потоков.
-    int outputAmount; ///< Максимально допустимое количество выходных потоков.
+private:
+    vector<double> flows;     ///< Массовые расходы, по одному на поток.
+    vector<uint32_t> nameIds; ///< Номера имён потоков, как в @ref Stream::getNameId.
 
 public:
     /**
-     * @brief Добавляет входной поток.
-     * @param s Указатель на поток, который нужно подключить ко входу.
+     * @brief Добавляет поток в таблицу; имя интернируется в @ref GlobalNames.
+     * @param name Имя потока.
+     * @param mass_flow Начальный массовый расход.
+     * @return Номер нового потока.
      */
-    void addInput(shared_ptr<Stream> s){
-      if(inputs.size() < inputAmount) inputs.push_back(s);
-      else throw"INPUT STREAM LIMIT!";
+    StreamId add(string_view name, double mass_flow = 0.0) {
+        flows.push_back(mass_flow);
+        nameIds.push_back(GlobalNames::intern(name));
+        return static_cast<StreamId>(flows.size() - 1);
     }
 
     /**
-     * @brief Добавляет выходной поток.
-     * @param s Указатель на поток, который устройство будет наполнять как выход.
+     * @brief Добавляет в таблицу копию потока; имя не копируется, берётся его номер.
+     * @param s Поток.
+     * @return Номер нового потока.
      */
-    void addOutput(shared_ptr<Stream> s){
-      if(outputs.size() < outputAmount) outputs.push_back(s);
-      else throw "OUTPUT STREAM LIMIT!";
+    StreamId add(const Stream& s) {
+        flows.push_back(s.getMassFlow());
+        nameIds.push_back(s.getNameId());
+        return static_cast<StreamId>(flows.size() - 1);
     }
 
     /**
-     * @brief Возвращает список входных потоков.
-     * @return Копия вектора @c vector<shared_ptr<Stream>> с текущими входами.
+     * @brief Удаляет все потоки.
      */
-    vector<shared_ptr<Stream>> getInputs() const { return inputs; }
-    
+    void clear() { flows.clear(); nameIds.clear(); }
+
     /**
-     * @brief Возвращает список выходных потоков.
-     * @return Копия вектора @c vector<shared_ptr<Stream>> с текущими выходами.
+     * @brief Количество потоков в таблице.
      */
-    vector<shared_ptr<Stream>> getOutputs() const { return outputs; }
+    size_t size() const { return flows.size(); }
 
     /**
-     * @brief Пересчитывает выходные потоки на основе входных.
+     * @brief Возвращает массовый расход потока.
+     * @param id Номер потока.
      */
-    virtual void updateOutputs() = 0;
+    double getMassFlow(StreamId id) const { return flows[id]; }
+
+    /**
+     * @brief Устанавливает массовый расход потока.
+     * @param id Номер потока.
+     * @param m Значение массового расхода.
+     */
+    void setMassFlow(StreamId id, double m) { flows[id] = m; }
+
+    /**
+     * @brief Возвращает имя потока.
+     * @param id Номер потока.
+     */
+    string getName(StreamId id) const { return GlobalNames::format(nameIds[id]); }
+
+    /**
+     * @brief Возвращает номер имени потока (см. @ref Stream::getNameId).
+     * @param id Номер потока.
+     */
+    uint32_t getNameId(StreamId id) const { return nameIds[id]; }
+
+    /**
+     * @brief Непрерывный массив расходов для вычислительных ядер.
+     */
+    double* data() { return flows.data(); }
+    const double* data() const { return flows.data(); }
 };
 
 
 /**
- * @class Mixer
- * @brief Устройство-миксер: суммирует расходы входных потоков и распределяет по выходам.
+ * @class PortView
+ * @brief Невладеющее представление непрерывного диапазона элементов (аналог @c std::span для C++17).
  */
-class Mixer: public Device
+template <class T>
+class PortView
 {
 private:
-    int _inputs_count = 0; ///< Разрешённое количество входных потоков, задаётся в конструкторе.
+    const T* first = nullptr; ///< Начало диапазона.
+    const T* last = nullptr;  ///< Конец диапазона (не включительно).
+
+public:
+    PortView() = default;
+    PortView(const T* b, const T* e): first(b), last(e) {}
+
+    const T* begin() const { return first; }
+    const T* end() const { return last; }
+    const T* data() const { return first; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    const T& operator[](size_t i) const { return first[i]; }
+};
+
+
+/**
+ * @class PortList
+ * @brief Список портов устройства: невладеющие указатели на потоки. Первые
+ *        @ref INLINE портов хранятся в самом устройстве без выделения памяти.
+ */
+class PortList
+{
+private:
+    static const size_t INLINE = 4; ///< Число портов без обращения к куче.
+    Stream* local[INLINE] = {};     ///< Порты, пока их не больше @ref INLINE.
+    vector<Stream*> heap;           ///< Все порты, если их больше @ref INLINE.
+    size_t count = 0;               ///< Число портов.
 
 public:
     /**
-     * @brief Создаёт миксер с заданным количеством входов.
-     * @param inputs_count Максимально допустимое число входных потоков.
+     * @brief Добавляет порт; при переполнении @ref local порты переносятся в @ref heap.
      */
-    Mixer(int inputs_count): Device() {
-        _inputs_count = inputs_count;
+    void push_back(Stream* s) {
+        if (count < INLINE) { local[count++] = s; return; }
+        if (count == INLINE) heap.assign(local, local + INLINE);
+        heap.push_back(s);
+        count++;
     }
 
+    Stream* const* data() const { return count <= INLINE ? local : heap.data(); }
+    Stream* const* begin() const { return data(); }
+    Stream* const* end() const { return data() + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Stream* operator[](size_t i) const { return data()[i]; }
+
     /**
-     * @brief Добавляет входной поток.
-     * @param s Умный указатель на поток @ref Stream для подключения ко входу.
+     * @throw std::out_of_range Если порта @p i нет.
      */
-    void addInput(shared_ptr<Stream> s) {
-        if (inputs.size() == _inputs_count) {
-            throw "Too much inputs"s;
-        }
-        inputs.push_back(s);
+    Stream* at(size_t i) const {
+        if (i >= count) throw out_of_range("PortList::at");
+        return data()[i];
     }
+};
 
+
+/**
+ * @class ProfileClock
+ * @brief Дешёвые отметки времени для статистики устройств: счётчик тактов
+ *        процессора (TSC) на x86, иначе @c steady_clock в наносекундах.
+ */
+class ProfileClock
+{
+private:
     /**
-     * @brief Добавляет выходной поток.
-     * @param s Умный указатель на поток @ref Stream, который будет заполнен на выходе.
+     * @brief Измеряет длительность такта по @c steady_clock на интервале ~10 мс.
      */
-    void addOutput(shared_ptr<Stream> s) {
-        if (outputs.size() == MIXER_OUTPUTS) {
-            throw "Too much outputs"s;
-        }
-        outputs.push_back(s);
+    static double calibrate() {
+#if defined(DEVICE_HAS_TSC)
+        using namespace chrono;
+        const auto t0 = steady_clock::now();
+        const uint64_t c0 = now();
+        while (steady_clock::now() - t0 < milliseconds(10)) {}
+        const uint64_t c1 = now();
+        const double ns = double(duration_cast<nanoseconds>(steady_clock::now() - t0).count());
+        return c1 > c0 ? ns / double(c1 - c0) : 1.0;
+#else
+        return 1.0;
+#endif
     }
 
+public:
     /**
-     * @brief Пересчитывает выходные потоки на основе входных.
+     * @brief Текущая отметка в тактах.
      */
-    void updateOutputs() override {
-        double sum_mass_flow = 0;
-        for (const auto& input_stream : inputs) {
-            sum_mass_flow += input_stream->getMassFlow();
-        }
+    static uint64_t now() noexcept {
+#if defined(DEVICE_HAS_TSC)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
 
-        if (outputs.empty()) {
-            throw "Should set outputs before update"s;
-        }
+    /**
+     * @brief Длительность одного такта в наносекундах (калибруется при первом вызове).
+     */
+    static double nanosPerTick() {
+        static const double k = calibrate();
+        return k;
+    }
+};
 
-        double output_mass = sum_mass_flow / outputs.size();
 
-        for (auto& output_stream : outputs) {
-            output_stream->setMassFlow(output_mass);
-        }
-    }
+/**
+ * @struct DeviceCounters
+ * @brief Статистика пересчётов одного устройства.
+ */
+struct DeviceCounters
+{
+    uint64_t calls = 0;      ///< Число пересчётов.
+    uint64_t exceptions = 0; ///< Сколько из них завершились исключением.
+    uint64_t totalTicks = 0; ///< Суммарное время в тактах @ref ProfileClock.
+    uint64_t maxTicks = 0;   ///< Наибольшее время одного пересчёта.
 };
 
 
 /**
- * @class Reactor
- * @brief Реактор с одним входом и 1–2 выходами, равномерно распределяющий расход.
+ * @struct TraceEvent
+ * @brief Событие трассировки: начало или конец участка.
  */
-class Reactor : public Device{
+struct TraceEvent
+{
+    const char* name;   ///< Название участка (строка со статическим временем жизни).
+    const void* object; ///< Объект участка (устройство) либо @c nullptr.
+    uint64_t ticks;     ///< Отметка @ref ProfileClock.
+    double value;       ///< Числовой аргумент (например, номер итерации) либо NaN.
+    char phase;         ///< 'B' — начало участка, 'E' — конец.
+};
+
+
+/**
+ * @class TraceBuffer
+ * @brief Кольцевой буфер событий одного потока.
+ *
+ * Пишет только поток-владелец; счётчик записанных событий публикуется с
+ * release-семантикой, поэтому читатель видит готовые события без блокировок.
+ * При переполнении затираются самые старые события.
+ */
+class TraceBuffer
+{
+private:
+    vector<TraceEvent> ring;       ///< События; размер — степень двойки.
+    size_t mask;                   ///< Маска индекса в @ref ring.
+    atomic<uint64_t> written{0};   ///< Сколько событий записано за всё время.
+
 public:
+    const uint32_t thread;         ///< Номер потока в трассе.
+
     /**
-     * @brief Конструктор: настраивает число выходов (1 или 2) при единственном входе.
-     * @param isDoubleReactor Если @c true — два выхода, иначе один.
+     * @param capacity Ёмкость; округляется вверх до степени двойки.
+     * @param threadId Номер потока в трассе.
      */
-    Reactor(bool isDoubleReactor) {
-        inputAmount = 1;
-        if (isDoubleReactor) outputAmount = 2;
-        else outputAmount = 1;
+    TraceBuffer(size_t capacity, uint32_t threadId): thread(threadId) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        ring.resize(n);
+        mask = n - 1;
     }
-    
+
     /**
-     * @brief Перерасчёт выходных потоков из входного.
+     * @brief Добавляет событие (только из потока-владельца).
      */
-    void updateOutputs() override{
-        double inputMass = inputs.at(0) -> getMassFlow();
-            for(int i = 0; i < outputAmount; i++){
-            double outputLocal = inputMass * (1.0/outputAmount);
-            outputs.at(i) -> setMassFlow(outputLocal);
-        }
+    void push(const TraceEvent& e) {
+        const uint64_t w = written.load(memory_order_relaxed);
+        ring[w & mask] = e;
+        written.store(w + 1, memory_order_release);
     }
+
+    /**
+     * @brief Сколько событий затёрто при переполнении.
+     */
+    uint64_t dropped() const {
+        const uint64_t w = written.load(memory_order_acquire);
+        return w > ring.size() ? w - ring.size() : 0;
+    }
+
+    /**
+     * @brief Обходит сохранённые события от старых к новым.
+     */
+    template <class F>
+    void forEach(F&& f) const {
+        const uint64_t end = written.load(memory_order_acquire);
+        for (uint64_t i = end > ring.size() ? end - ring.size() : 0; i < end; i++) f(ring[i & mask]);
+    }
+};
+
+
+/**
+ * @class Tracer
+ * @brief Запись временной шкалы расчёта для просмотра в chrome://tracing или Perfetto.
+ *
+ * Пока трассировщик запущен (@ref start), участки @ref TraceScope — пересчёты
+ * устройств, проходы схемы, рециклы и их итерации — пишутся в кольцевой буфер
+ * своего потока; буфер создаётся при первом событии потока. Без активного
+ * трассировщика участок стоит одной атомарной загрузки. Останавливать,
+ * уничтожать трассировщик и выгружать трассу следует, когда расчёт не идёт.
+ */
+class Tracer
+{
+private:
+    static inline atomic<Tracer*> current{nullptr};  ///< Активный трассировщик.
+    static inline atomic<uint64_t> sessions{0};      ///< Счётчик запусков для сброса буферов потоков.
+
+    size_t capacity;                          ///< Ёмкость буфера одного потока.
+    uint64_t session = 0;                     ///< Номер текущего запуска.
+    uint64_t origin = 0;                      ///< Отметка времени запуска.
+    mutable mutex lock;                       ///< Защищает @ref buffers и @ref labels.
+    vector<unique_ptr<TraceBuffer>> buffers;  ///< Буферы потоков текущего запуска.
+    unordered_map<const void*, string> labels; ///< Подписи объектов для выгрузки.
+
+    /**
+     * @brief Буфер вызывающего потока в текущем запуске.
+     */
+    TraceBuffer& local() {
+        thread_local TraceBuffer* buffer = nullptr;
+        thread_local uint64_t bufferSession = 0;
+        if (bufferSession != session) {
+            lock_guard<mutex> guard(lock);
+            buffers.push_back(make_unique<TraceBuffer>(capacity, static_cast<uint32_t>(buffers.size())));
+            buffer = buffers.back().get();
+            bufferSession = session;
+        }
+        return *buffer;
+    }
+
+    /**
+     * @brief Пишет название для JSON, экранируя кавычки и обратную косую черту.
+     */
+    static void writeName(ostream& os, const char* s) {
+        for (; *s; s++) {
+            if (*s == '"' || *s == '\\') os << '\\';
+            os << *s;
+        }
+    }
+
+public:
+    /**
+     * @param eventsPerThread Ёмкость буфера каждого потока.
+     */
+    explicit Tracer(size_t eventsPerThread = 65536): capacity(max<size_t>(eventsPerThread, 2)) {}
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    ~Tracer() { stop(); }
+
+    /**
+     * @brief Делает трассировщик активным, отбрасывая события прошлого запуска.
+     */
+    void start() {
+        stop();
+        {
+            lock_guard<mutex> guard(lock);
+            buffers.clear();
+        }
+        session = ++sessions;
+        local();                                   // буфер вызывающего потока — заранее
+        origin = ProfileClock::now();
+        current.store(this, memory_order_release);
+    }
+
+    /**
+     * @brief Прекращает запись; накопленные события сохраняются до следующего @ref start.
+     */
+    void stop() {
+        Tracer* self = this;
+        current.compare_exchange_strong(self, nullptr);
+    }
+
+    /**
+     * @brief Активный трассировщик или @c nullptr.
+     */
+    static Tracer* active() { return current.load(memory_order_acquire); }
+
+    /**
+     * @brief Записывает событие в буфер вызывающего потока, если трассировка активна.
+     */
+    static void record(const char* name, const void* object, double value, char phase) {
+        if (Tracer* t = active()) t->local().push({name, object, ProfileClock::now(), value, phase});
+    }
+
+    /**
+     * @brief Задаёт подпись объекта, которая заменит название его участков при выгрузке.
+     */
+    void setLabel(const void* object, string label) {
+        lock_guard<mutex> guard(lock);
+        labels[object] = move(label);
+    }
+
+    /**
+     * @brief Число сохранённых событий во всех потоках.
+     */
+    size_t eventCount() const {
+        lock_guard<mutex> guard(lock);
+        size_t n = 0;
+        for (const auto& b : buffers) b->forEach([&n](const TraceEvent&) { n++; });
+        return n;
+    }
+
+    /**
+     * @brief Число событий, затёртых при переполнении буферов.
+     */
+    uint64_t droppedCount() const {
+        lock_guard<mutex> guard(lock);
+        uint64_t n = 0;
+        for (const auto& b : buffers) n += b->dropped();
+        return n;
+    }
+
+    /**
+     * @brief Выгружает трассу в формате Chrome Trace Event (JSON).
+     * @param os Поток вывода.
+     */
+    void exportChromeTrace(ostream& os) const {
+        lock_guard<mutex> guard(lock);
+        const double usPerTick = ProfileClock::nanosPerTick() / 1000.0;
+        const auto flags = os.flags();
+        const auto precision = os.precision();
+        os << fixed << setprecision(3) << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto& b : buffers) {
+            os << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->thread
+               << ",\"args\":{\"name\":\"thread " << b->thread << "\"}}";
+            first = false;
+            b->forEach([&](const TraceEvent& e) {
+                const auto label = e.object ? labels.find(e.object) : labels.end();
+                os << ",\n{\"name\":\"";
+                writeName(os, label != labels.end() ? label->second.c_str() : e.name);
+                os << "\",\"ph\":\"" << e.phase << "\",\"pid\":1,\"tid\":" << b->thread
+                   << ",\"ts\":" << double(e.ticks - origin) * usPerTick;
+                if (!isnan(e.value)) os << ",\"args\":{\"value\":" << e.value << "}";
+                os << "}";
+            });
+        }
+        os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+
+/**
+ * @class TraceScope
+ * @brief Участок трассы: событие начала в конструкторе и конца в деструкторе.
+ */
+class TraceScope
+{
+private:
+    const char* name;   ///< Название; @c nullptr — трассировка не ведётся.
+    const void* object; ///< Объект участка.
+
+public:
+    /**
+     * @param n Название участка (статическая строка); @c nullptr — не записывать.
+     * @param o Объект участка (устройство) для подписи при выгрузке.
+     * @param value Числовой аргумент начала участка.
+     */
+    explicit TraceScope(const char* n, const void* o = nullptr, double value = NAN)
+        : name(n && Tracer::active() ? n : nullptr), object(o) {
+        if (name) Tracer::record(name, object, value, 'B');
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    ~TraceScope() {
+        if (name) Tracer::record(name, object, NAN, 'E');
+    }
+};
+
+
+/**
+ * @class Device
+ * @brief Абстрактное устройство с набором входных и выходных потоков.
+ */
+class Device
+{
+protected:
+    PortList inputs;  ///< Входные потоки, подключённые к устройству.
+    PortList outputs; ///< Выходные потоки, формируемые устройством.
+    vector<shared_ptr<Stream>> owners; ///< Потоки, подключённые через @ref addInput / @ref addOutput; устройство продлевает их жизнь.
+    int inputAmount; ///< Максимально допустимое количество входных потоков.
+    int outputAmount; ///< Максимально допустимое количество выходных потоков.
+    uint32_t nameId = 0; ///< Номер имени в @ref GlobalNames; 0 — имя не задано.
+#if defined(DEVICE_PROFILING)
+    mutable DeviceCounters stats; ///< Статистика пересчётов через @ref profiled.
+
+    /**
+     * @brief Учитывает один пересчёт длительностью @p ticks.
+     */
+    void record(uint64_t ticks) const {
+        stats.calls++;
+        stats.totalTicks += ticks;
+        stats.maxTicks = max(stats.maxTicks, ticks);
+    }
+#endif
+
+public:
+    /**
+     * @brief Устанавливает имя устройства.
+     * @param s Новое имя.
+     */
+    void setName(string_view s) { nameId = GlobalNames::intern(s); }
+
+    /**
+     * @brief Возвращает имя устройства (пустое, если не задано).
+     */
+    const string& getName() const { return GlobalNames::get(nameId); }
+
+    /**
+     * @brief Возвращает номер имени в @ref GlobalNames.
+     */
+    uint32_t getNameId() const { return nameId; }
+
+    /**
+     * @brief Подключает поток ко входу, не владея им: поток должен жить дольше
+     *        устройства (например, принадлежать той же @ref Flowsheet).
+     * @param s Поток, который нужно подключить ко входу.
+     */
+    virtual void attachInput(Stream* s){
+      if(inputs.size() < inputAmount) inputs.push_back(s);
+      else throw"INPUT STREAM LIMIT!";
+    }
+
+    /**
+     * @brief Подключает поток к выходу, не владея им (см. @ref attachInput).
+     * @param s Поток, который устройство будет наполнять как выход.
+     */
+    virtual void attachOutput(Stream* s){
+      if(outputs.size() < outputAmount) outputs.push_back(s);
+      else throw "OUTPUT STREAM LIMIT!";
+    }
+
+    /**
+     * @brief Добавляет входной поток; устройство разделяет владение им.
+     * @param s Указатель на поток, который нужно подключить ко входу.
+     */
+    void addInput(shared_ptr<Stream> s){
+      attachInput(s.get());
+      owners.push_back(move(s));
+    }
+
+    /**
+     * @brief Добавляет выходной поток; устройство разделяет владение им.
+     * @param s Указатель на поток, который устройство будет наполнять как выход.
+     */
+    void addOutput(shared_ptr<Stream> s){
+      attachOutput(s.get());
+      owners.push_back(move(s));
+    }
+
+    /**
+     * @brief Указатель на поток порта: владеющий, если поток подключён через
+     *        @ref addInput / @ref addOutput, иначе невладеющий.
+     */
+    shared_ptr<Stream> share(Stream* s) const {
+      for (const auto& o : owners)
+        if (o.get() == s) return o;
+      return shared_ptr<Stream>(shared_ptr<Stream>(), s);
+    }
+
+    /**
+     * @brief Возвращает список входных потоков.
+     * @return Вектор @c vector<shared_ptr<Stream>> с текущими входами (см. @ref share).
+     */
+    vector<shared_ptr<Stream>> getInputs() const {
+      vector<shared_ptr<Stream>> result;
+      for (Stream* s : inputs) result.push_back(share(s));
+      return result;
+    }
+    
+    /**
+     * @brief Возвращает список выходных потоков.
+     * @return Вектор @c vector<shared_ptr<Stream>> с текущими выходами (см. @ref share).
+     */
+    vector<shared_ptr<Stream>> getOutputs() const {
+      vector<shared_ptr<Stream>> result;
+      for (Stream* s : outputs) result.push_back(share(s));
+      return result;
+    }
+
+    /**
+     * @brief Представление входных потоков без копирования и счётчиков ссылок.
+     * @return Диапазон, действительный до следующего изменения входов устройства.
+     */
+    PortView<Stream*> inputsView() const { return {inputs.begin(), inputs.end()}; }
+
+    /**
+     * @brief Представление выходных потоков без копирования и счётчиков ссылок.
+     * @return Диапазон, действительный до следующего изменения выходов устройства.
+     */
+    PortView<Stream*> outputsView() const { return {outputs.begin(), outputs.end()}; }
+
+    /**
+     * @brief Пересчитывает выходные потоки на основе входных.
+     */
+    virtual void updateOutputs() = 0;
+
+    /**
+     * @brief Пересчёт в табличном режиме: расходы читаются и пишутся в плотный массив
+     *        по номерам портов, без обращения к объектам @ref Stream.
+     *
+     * Аргументы: массив расходов @ref StreamTable, номера входных потоков и их
+     * число, номера выходных потоков и их число.
+     * @throw std::string Если устройство не поддерживает табличный режим (по умолчанию).
+     */
+    virtual void updateTable(double*, const StreamId*, size_t,
+                             const StreamId*, size_t) const {
+        throw "Device does not support table evaluation"s;
+    }
+
+    /**
+     * @brief Линейная модель устройства: каждый выход равен одной и той же доле суммы входов.
+     * @return Доля суммы входов на каждый выход; отрицательное значение — устройство нелинейно.
+     */
+    virtual double linearShare() const { return -1.0; }
+
+    /**
+     * @brief Число переменных состояния (запасов) устройства для @ref DynamicSimulator.
+     * @return 0 для безынерционного устройства, выходы которого — мгновенная функция входов.
+     */
+    virtual size_t stateSize() const { return 0; }
+
+    /**
+     * @brief Копирует переменные состояния в массив из @ref stateSize элементов.
+     */
+    virtual void saveState(double*) const {}
+
+    /**
+     * @brief Устанавливает переменные состояния из массива из @ref stateSize элементов.
+     */
+    virtual void loadState(const double*) {}
+
+    /**
+     * @brief Записывает в массив из @ref stateSize элементов производные
+     *        переменных состояния по времени при текущих расходах портов.
+     */
+    virtual void stateRate(double*) const {}
+
+    /**
+     * @brief Заявленное число входов устройства.
+     */
+    int inputLimit() const { return inputAmount; }
+
+    /**
+     * @brief Заявленное число выходов устройства.
+     */
+    int outputLimit() const { return outputAmount; }
+
+    /**
+     * @brief Название вида устройства для отчётов.
+     */
+    virtual const char* typeName() const { return "Device"; }
+
+    /**
+     * @brief Выполняет пересчёт @p f этого устройства. При сборке с DEVICE_PROFILING
+     *        учитывает вызов, его время и исключение в @ref counters, иначе просто вызывает @p f.
+     *        При активном @ref Tracer пересчёт записывается участком трассы.
+     * @param f Пересчёт: @ref updateOutputs, @ref updateTable или их невиртуальный вызов.
+     */
+    template <class F>
+    void profiled(F&& f) const {
+        const TraceScope trace(Tracer::active() ? typeName() : nullptr, this);
+#if defined(DEVICE_PROFILING)
+        const uint64_t start = ProfileClock::now();
+        try {
+            f();
+        } catch (...) {
+            stats.exceptions++;
+            record(ProfileClock::now() - start);
+            throw;
+        }
+        record(ProfileClock::now() - start);
+#else
+        f();
+#endif
+    }
+
+    /**
+     * @brief @ref updateOutputs с учётом в статистике (см. @ref profiled).
+     */
+    void profiledUpdate() { profiled([this] { updateOutputs(); }); }
+
+    /**
+     * @brief Статистика пересчётов; без DEVICE_PROFILING всегда нулевая.
+     */
+    DeviceCounters counters() const {
+#if defined(DEVICE_PROFILING)
+        return stats;
+#else
+        return {};
+#endif
+    }
+
+    /**
+     * @brief Обнуляет статистику пересчётов.
+     */
+    void resetCounters() {
+#if defined(DEVICE_PROFILING)
+        stats = {};
+#endif
+    }
+
+    virtual ~Device() = default;
+};
+
+
+/**
+ * @class Mixer
+ * @brief Устройство-миксер: суммирует расходы входных потоков и распределяет по выходам.
+ */
+class Mixer: public Device
+{
+private:
+    int _inputs_count = 0; ///< Разрешённое количество входных потоков, задаётся в конструкторе.
+
+public:
+    /**
+     * @brief Создаёт миксер с заданным количеством входов.
+     * @param inputs_count Максимально допустимое число входных потоков.
+     */
+    Mixer(int inputs_count): Device() {
+        _inputs_count = inputs_count;
+        inputAmount = inputs_count;
+        outputAmount = MIXER_OUTPUTS;
+    }
+
+    /**
+     * @brief Подключает входной поток.
+     * @param s Поток @ref Stream для подключения ко входу.
+     */
+    void attachInput(Stream* s) override {
+        if (inputs.size() == _inputs_count) {
+            throw "Too much inputs"s;
+        }
+        inputs.push_back(s);
+    }
+
+    /**
+     * @brief Подключает выходной поток.
+     * @param s Поток @ref Stream, который будет заполнен на выходе.
+     */
+    void attachOutput(Stream* s) override {
+        if (outputs.size() == MIXER_OUTPUTS) {
+            throw "Too much outputs"s;
+        }
+        outputs.push_back(s);
+    }
+
+    /**
+     * @brief Пересчитывает выходные потоки на основе входных.
+     */
+    void updateOutputs() override {
+        double sum_mass_flow = 0;
+        for (const auto& input_stream : inputs) {
+            sum_mass_flow += input_stream->getMassFlow();
+        }
+
+        if (outputs.empty()) {
+            throw "Should set outputs before update"s;
+        }
+
+        if (!inputs.empty() && inputs[0]->componentCount() > 0) {
+            mixComponents();
+            return;
+        }
+
+        double output_mass = sum_mass_flow / outputs.size();
+
+        for (auto& output_stream : outputs) {
+            output_stream->setMassFlow(output_mass);
+        }
+    }
+
+    /**
+     * @brief Покомпонентная часть @ref updateOutputs: сумма составов входов, поровну
+     *        на выходы; суммарный расход выхода — сумма его компонентов.
+     * @throw std::string Если у входов разное число компонентов.
+     */
+    void mixComponents() {
+        const size_t n = inputs[0]->componentCount();
+        for (const auto& input_stream : inputs) {
+            if (input_stream->componentCount() != n) {
+                throw "Inputs have different component counts"s;
+            }
+        }
+
+        Stream& first = *outputs[0];
+        first.resizeComponents(n);
+        double* acc = first.componentData();
+        scaleComponents(acc, inputs[0]->componentData(), 1.0, n);
+        for (size_t i = 1; i < inputs.size(); i++) {
+            addComponents(acc, inputs[i]->componentData(), n);
+        }
+        scaleComponents(acc, acc, 1.0 / outputs.size(), n);
+        first.commitComponents();
+        for (size_t o = 1; o < outputs.size(); o++) {
+            outputs[o]->resizeComponents(n);
+            scaleComponents(outputs[o]->componentData(), acc, 1.0, n);
+            outputs[o]->commitComponents();
+        }
+    }
+
+    /**
+     * @brief Табличный вариант @ref updateOutputs.
+     */
+    void updateTable(double* flows, const StreamId* in, size_t nIn,
+                     const StreamId* out, size_t nOut) const override {
+        double sum_mass_flow = 0;
+        for (size_t i = 0; i < nIn; i++) {
+            sum_mass_flow += flows[in[i]];
+        }
+
+        if (nOut == 0) {
+            throw "Should set outputs before update"s;
+        }
+
+        double output_mass = sum_mass_flow / nOut;
+
+        for (size_t i = 0; i < nOut; i++) {
+            flows[out[i]] = output_mass;
+        }
+    }
+
+    /**
+     * @brief Миксер делит сумму входов поровну между выходами.
+     */
+    double linearShare() const override {
+        return outputs.empty() ? -1.0 : 1.0 / outputs.size();
+    }
+
+    const char* typeName() const override { return "Mixer"; }
+};
+
+
+/**
+ * @class Reactor
+ * @brief Реактор с одним входом и 1–2 выходами, равномерно распределяющий расход.
+ */
+class Reactor : public Device{
+private:
+    size_t reactionComponents = 0; ///< Число компонентов, для которого задана стехиометрия.
+    vector<double> stoichiometry;  ///< Массовые стехиометрические коэффициенты, реакции по строкам.
+    vector<long> keyComponents;    ///< Ключевой компонент реакции; -1 — задана степень полноты.
+    vector<double> amounts;        ///< Конверсия ключевого компонента либо фиксированная степень полноты.
+
+    /**
+     * @brief Проверяет и запоминает стехиометрическую матрицу.
+     */
+    void setStoichiometry(size_t components, const vector<double>& nu) {
+        if (components == 0 || nu.size() % components != 0) {
+            throw "Stoichiometry does not match component count"s;
+        }
+        for (size_t r = 0; r < nu.size() / components; r++) {
+            double balance = 0.0, scale = 0.0;
+            for (size_t c = 0; c < components; c++) {
+                balance += nu[r*components + c];
+                scale = max(scale, fabs(nu[r*components + c]));
+            }
+            if (fabs(balance) > 1e-9 * max(scale, 1.0)) {
+                throw "Reaction does not conserve mass"s;
+            }
+        }
+        reactionComponents = components;
+        stoichiometry = nu;
+    }
+
+public:
+    /**
+     * @brief Конструктор: настраивает число выходов (1 или 2) при единственном входе.
+     * @param isDoubleReactor Если @c true — два выхода, иначе один.
+     */
+    Reactor(bool isDoubleReactor) {
+        inputAmount = 1;
+        if (isDoubleReactor) outputAmount = 2;
+        else outputAmount = 1;
+    }
+
+    /**
+     * @brief Задаёт реакции через конверсию ключевых компонентов.
+     *
+     * Реакции применяются последовательно: степень полноты r-й реакции равна
+     * conversions[r]·x[key] / (−nu[r][key]), где x — состав после предыдущих реакций.
+     * @param components Число компонентов.
+     * @param nu Массовые стехиометрические коэффициенты, по строке на реакцию; сумма строки равна нулю.
+     * @param keys Ключевой (расходуемый) компонент каждой реакции.
+     * @param conversions Доля ключевого компонента, вступающая в реакцию, от 0 до 1.
+     * @throw std::string Если размеры не согласованы, реакция не сохраняет массу,
+     *        ключевой компонент не расходуется или конверсия вне [0, 1].
+     */
+    void setReactions(size_t components, const vector<double>& nu,
+                      const vector<size_t>& keys, const vector<double>& conversions) {
+        setStoichiometry(components, nu);
+        const size_t r = nu.size() / components;
+        if (keys.size() != r || conversions.size() != r) {
+            throw "Reaction count mismatch"s;
+        }
+        keyComponents.assign(r, 0);
+        for (size_t i = 0; i < r; i++) {
+            if (keys[i] >= components || nu[i*components + keys[i]] >= 0.0) {
+                throw "Key component must be consumed by its reaction"s;
+            }
+            if (conversions[i] < 0.0 || conversions[i] > 1.0) {
+                throw "Conversion must be within [0, 1]"s;
+            }
+            keyComponents[i] = static_cast<long>(keys[i]);
+        }
+        amounts = conversions;
+    }
+
+    /**
+     * @brief Задаёт реакции с фиксированными степенями полноты (массовый расход на единицу коэффициента).
+     *
+     * Степень полноты не зависит от сырья, поэтому расходуемых компонентов на
+     * входе должно хватать на каждую реакцию; иначе пересчёт бросает исключение (см. @ref react).
+     * @param components Число компонентов.
+     * @param nu Массовые стехиометрические коэффициенты, по строке на реакцию.
+     * @param extents Степень полноты каждой реакции, конечная и неотрицательная.
+     * @throw std::string Если размеры не согласованы, реакция не сохраняет массу
+     *        или степень полноты отрицательна либо не конечна.
+     */
+    void setExtents(size_t components, const vector<double>& nu, const vector<double>& extents) {
+        setStoichiometry(components, nu);
+        if (extents.size() != nu.size() / components) {
+            throw "Reaction count mismatch"s;
+        }
+        for (double e : extents) {
+            if (!isfinite(e) || e < 0.0) {
+                throw "Extent must be finite and non-negative"s;
+            }
+        }
+        keyComponents.assign(extents.size(), -1);
+        amounts = extents;
+    }
+
+    /**
+     * @brief Число заданных реакций.
+     */
+    size_t reactionCount() const { return amounts.size(); }
+
+    /**
+     * @brief Применяет реакции к составу на месте.
+     * @param x Покомпонентные расходы, @ref reactionComponents элементов.
+     * @throw std::string Если фиксированной степени полноты не хватает расходуемого компонента;
+     *        @p x тогда содержит результат предыдущих реакций.
+     */
+    void react(double* x) const {
+        const size_t n = reactionComponents;
+        for (size_t r = 0; r < amounts.size(); r++) {
+            const double* nu = stoichiometry.data() + r*n;
+            double extent = amounts[r];
+            if (keyComponents[r] >= 0) {
+                extent *= x[keyComponents[r]] / -nu[keyComponents[r]];
+            } else {
+                for (size_t c = 0; c < n; c++) {
+                    if (nu[c] < 0.0 && x[c] + nu[c]*extent < -1e-12 * max(1.0, x[c])) {
+                        throw "Not enough feed for reaction extent"s;
+                    }
+                }
+            }
+            axpyComponents(x, nu, extent, n);
+        }
+    }
+    
+    /**
+     * @brief Перерасчёт выходных потоков из входного.
+     */
+    void updateOutputs() override{
+        double inputMass = inputs.at(0) -> getMassFlow();
+        const size_t n = inputs[0]->componentCount();
+        if (n == 0) {
+            for(int i = 0; i < outputAmount; i++){
+                double outputLocal = inputMass * (1.0/outputAmount);
+                outputs.at(i) -> setMassFlow(outputLocal);
+            }
+        } else {
+            if (!amounts.empty() && n != reactionComponents) {
+                throw "Input component count does not match reactions"s;
+            }
+            if (outputs.size() < static_cast<size_t>(outputAmount)) {
+                throw out_of_range("Reactor ports are not connected");
+            }
+            Stream& first = *outputs[0];
+            first.resizeComponents(n);
+            double* x = first.componentData();
+            scaleComponents(x, inputs[0]->componentData(), 1.0, n);
+            react(x);
+            for (int i = outputAmount - 1; i >= 0; i--) {
+                outputs[i]->resizeComponents(n);
+                scaleComponents(outputs[i]->componentData(), x, 1.0/outputAmount, n);
+                outputs[i]->commitComponents();
+            }
+        }
+    }
+
+    /**
+     * @brief Табличный вариант @ref updateOutputs.
+     */
+    void updateTable(double* flows, const StreamId* in, size_t nIn,
+                     const StreamId* out, size_t nOut) const override {
+        if (nIn < 1 || nOut < static_cast<size_t>(outputAmount)) {
+            throw out_of_range("Reactor ports are not connected");
+        }
+        double inputMass = flows[in[0]];
+        for (int i = 0; i < outputAmount; i++) {
+            flows[out[i]] = inputMass * (1.0/outputAmount);
+        }
+    }
+
+    /**
+     * @brief Реактор делит единственный вход поровну между @ref outputAmount выходами.
+     */
+    double linearShare() const override { return 1.0 / outputAmount; }
+
+    const char* typeName() const override { return "Reactor"; }
+};
+
+
+/**
+ * @class Tank
+ * @brief Ёмкость с запасом массы: выходной расход равен запасу, делённому на
+ *        время пребывания, а запас меняется со скоростью «сумма входов − выход».
+ *
+ * Выход зависит только от запаса, поэтому в стационарных режимах
+ * (@ref Flowsheet::run) ёмкость отдаёт расход по текущему запасу, а в
+ * @ref DynamicSimulator запас интегрируется по времени. Учитываются только
+ * суммарные расходы; заданный состав выхода лишь масштабируется (@ref Stream::setMassFlow).
+ */
+class Tank : public Device
+{
+private:
+    double holdup = 0.0;        ///< Запас массы.
+    double residenceTime = 1.0; ///< Время пребывания: отношение запаса к выходному расходу.
+
+public:
+    /**
+     * @brief Создаёт ёмкость с одним выходом.
+     * @param inputs_count Максимально допустимое число входных потоков.
+     * @param residence_time Время пребывания, больше нуля.
+     * @param initial_holdup Начальный запас массы.
+     * @throw std::string Если время пребывания не положительно.
+     */
+    Tank(int inputs_count, double residence_time, double initial_holdup = 0.0) {
+        if (!(residence_time > 0.0)) {
+            throw "Residence time must be positive"s;
+        }
+        inputAmount = inputs_count;
+        outputAmount = 1;
+        residenceTime = residence_time;
+        holdup = initial_holdup;
+    }
+
+    /**
+     * @brief Возвращает запас массы.
+     */
+    double getHoldup() const { return holdup; }
+
+    /**
+     * @brief Устанавливает запас массы.
+     * @param m Новый запас.
+     */
+    void setHoldup(double m) { holdup = m; }
+
+    /**
+     * @brief Возвращает время пребывания.
+     */
+    double getResidenceTime() const { return residenceTime; }
+
+    /**
+     * @brief Записывает в выход расход, соответствующий текущему запасу.
+     */
+    void updateOutputs() override {
+        if (outputs.empty()) {
+            throw "Should set outputs before update"s;
+        }
+        outputs[0]->setMassFlow(holdup / residenceTime);
+    }
+
+    /**
+     * @brief Табличный вариант @ref updateOutputs.
+     */
+    void updateTable(double* flows, const StreamId*, size_t,
+                     const StreamId* out, size_t nOut) const override {
+        if (nOut == 0) {
+            throw "Should set outputs before update"s;
+        }
+        flows[out[0]] = holdup / residenceTime;
+    }
+
+    size_t stateSize() const override { return 1; }
+    void saveState(double* x) const override { x[0] = holdup; }
+    void loadState(const double* x) override { holdup = x[0]; }
+
+    /**
+     * @brief Скорость изменения запаса: сумма входов минус выход.
+     */
+    void stateRate(double* dx) const override {
+        double sum_mass_flow = 0;
+        for (const auto& input_stream : inputs) {
+            sum_mass_flow += input_stream->getMassFlow();
+        }
+        dx[0] = sum_mass_flow - holdup / residenceTime;
+    }
+
+    const char* typeName() const override { return "Tank"; }
+};
+
+
+/**
+ * @brief Метод сходимости рецикла.
+ */
+enum class RecycleMethod
+{
+    DirectSubstitution, ///< Простая итерация x = g(x).
+    Wegstein,           ///< Ускорение Вегстейна с ограничением коэффициента q.
+    Anderson            ///< Ускорение Андерсона по нескольким последним итерациям.
+};
+
+/**
+ * @struct RecycleOptions
+ * @brief Настройки решателя рециклов @ref Flowsheet::solve.
+ */
+struct RecycleOptions
+{
+    RecycleMethod method = RecycleMethod::Wegstein; ///< Метод сходимости.
+    int maxIterations = 200;   ///< Предельное число итераций на один рецикл.
+    double tolerance = 1e-9;   ///< Допустимая относительная невязка разрываемых потоков.
+    int andersonDepth = 5;     ///< Глубина истории для метода Андерсона.
+    double wegsteinMin = -5.0; ///< Нижняя граница коэффициента q Вегстейна.
+    double wegsteinMax = 0.0;  ///< Верхняя граница коэффициента q Вегстейна.
+};
+
+/**
+ * @struct RecycleReport
+ * @brief Итог работы @ref Flowsheet::solve.
+ */
+struct RecycleReport
+{
+    bool converged = true; ///< Сошлись ли все рециклы.
+    int loops = 0;         ///< Число циклических компонент схемы.
+    int tears = 0;         ///< Число разрываемых потоков.
+    int iterations = 0;    ///< Суммарное число итераций по всем рециклам.
+    double residual = 0.0; ///< Наибольшая итоговая невязка.
+};
+
+
+/**
+ * @brief Решает плотную систему A·x = b методом Гаусса с выбором ведущего элемента.
+ * @param a Матрица n×n по строкам; портится.
+ * @param b Правая часть; заменяется решением.
+ * @param n Размер системы.
+ * @return @c false, если матрица вырождена.
+ */
+inline bool solveDense(double* a, double* b, size_t n) {
+    for (size_t c = 0; c < n; c++) {
+        size_t p = c;
+        for (size_t r = c + 1; r < n; r++)
+            if (fabs(a[r*n + c]) > fabs(a[p*n + c])) p = r;
+        if (a[p*n + c] == 0.0) return false;
+        if (p != c) {
+            for (size_t k = 0; k < n; k++) swap(a[p*n + k], a[c*n + k]);
+            swap(b[p], b[c]);
+        }
+        for (size_t r = c + 1; r < n; r++) {
+            double l = a[r*n + c] / a[c*n + c];
+            for (size_t k = c; k < n; k++) a[r*n + k] -= l * a[c*n + k];
+            b[r] -= l * b[c];
+        }
+    }
+    for (size_t c = n; c-- > 0;) {
+        for (size_t k = c + 1; k < n; k++) b[c] -= a[c*n + k] * b[k];
+        b[c] /= a[c*n + c];
+    }
+    return true;
+}
+
+
+/**
+ * @class ObjectPool
+ * @brief Пул объектов, размещаемых блоками по @p BlockSize штук.
+ *
+ * Адреса объектов стабильны на всё время жизни пула; объекты не удаляются по
+ * одному, а разрушаются вместе с пулом, память освобождается поблочно.
+ */
+template <class T, size_t BlockSize = 4096>
+class ObjectPool
+{
+private:
+    /**
+     * @struct Block
+     * @brief Неинициализированная память под @p BlockSize объектов.
+     */
+    struct Block
+    {
+        alignas(T) unsigned char data[sizeof(T) * BlockSize];
+    };
+    vector<unique_ptr<Block>> blocks; ///< Выделенные блоки.
+    size_t count = 0;                 ///< Количество созданных объектов.
+
+public:
+    ObjectPool() = default;
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+    ~ObjectPool() { clear(); }
+
+    /**
+     * @brief Создаёт объект в пуле.
+     * @param args Аргументы конструктора @p T.
+     * @return Ссылка на созданный объект; остаётся действительной до разрушения пула.
+     */
+    template <class... Args>
+    T& emplace(Args&&... args) {
+        if (count == blocks.size() * BlockSize) blocks.emplace_back(new Block);
+        T* p = reinterpret_cast<T*>(blocks.back()->data) + count % BlockSize;
+        new (p) T(std::forward<Args>(args)...);
+        count++;
+        return *p;
+    }
+
+    /**
+     * @brief Объект по порядковому номеру создания.
+     */
+    T& operator[](size_t i) { return reinterpret_cast<T*>(blocks[i / BlockSize]->data)[i % BlockSize]; }
+
+    /**
+     * @brief Количество объектов в пуле.
+     */
+    size_t size() const { return count; }
+
+    /**
+     * @brief Разрушает все объекты (в обратном порядке) и освобождает блоки.
+     */
+    void clear() {
+        while (count > 0) {
+            count--;
+            (*this)[count].~T();
+        }
+        blocks.clear();
+    }
+};
+
+
+/**
+ * @struct DeviceArena
+ * @brief Пулы устройств, которыми владеет схема.
+ */
+struct DeviceArena
+{
+    ObjectPool<Mixer> mixers;     ///< Миксеры схемы.
+    ObjectPool<Reactor> reactors; ///< Реакторы схемы.
+};
+
+
+/**
+ * @struct DeviceProfile
+ * @brief Строка таблицы статистики @ref Flowsheet::profile.
+ */
+struct DeviceProfile
+{
+    size_t device = 0;          ///< Индекс устройства в порядке добавления.
+    const char* type = "";      ///< Вид устройства (@ref Device::typeName).
+    uint64_t calls = 0;         ///< Число пересчётов.
+    uint64_t exceptions = 0;    ///< Пересчётов, завершившихся исключением.
+    double totalNs = 0.0;       ///< Суммарное время, нс.
+    double maxNs = 0.0;         ///< Наибольшее время одного пересчёта, нс.
+};
+
+/**
+ * @brief Формат вывода @ref Flowsheet::printProfile.
+ */
+enum class ProfileFormat
+{
+    Text, ///< Строка на устройство, самые медленные устройства сверху.
+    Csv   ///< CSV с заголовком, устройства в порядке добавления.
+};
+
+
+/**
+ * @class Flowsheet
+ * @brief Технологическая схема: владеет устройствами и потоками, строит по их
+ *        портам граф «производитель → потребитель» и пересчитывает устройства
+ *        за один проход в топологическом порядке.
+ */
+class Flowsheet
+{
+private:
+    vector<shared_ptr<Device>> devices; ///< Устройства схемы в порядке добавления.
+    vector<shared_ptr<Stream>> streams; ///< Потоки схемы (явно добавленные и найденные в портах).
+    shared_ptr<ObjectPool<Stream>> streamArena; ///< Пул потоков, созданных @ref newStream.
+    shared_ptr<DeviceArena> deviceArena;        ///< Пулы устройств, созданных @ref newMixer / @ref newReactor.
+    vector<vector<size_t>> consumers;   ///< Для каждого устройства — индексы устройств, читающих его выходы.
+    vector<Device*> order;              ///< Топологический порядок пересчёта.
+    vector<size_t> orderIndex;          ///< Индексы в @ref devices для устройств из @ref order.
+    unordered_map<const Stream*, StreamId> streamIds; ///< Номер потока = его индекс в @ref streams.
+    vector<StreamId> ports;             ///< Номера потоков портов устройств из @ref order: входы, затем выходы.
+    vector<size_t> portOffsets;         ///< Для k-го устройства входы — [2k, 2k+1), выходы — [2k+1, 2k+2) в @ref ports.
+    bool scheduled = false;             ///< Актуальны ли граф, порядок и порты.
+
+    /**
+     * @struct Block
+     * @brief Сильно связная компонента графа устройств в порядке пересчёта.
+     */
+    struct Block
+    {
+        vector<Device*> devices; ///< Устройства компоненты; в рецикле — порядок без разорванных дуг.
+        vector<Stream*> tears;   ///< Разрываемые потоки; пусто для ациклической компоненты.
+    };
+    vector<double> seenInputs;  ///< Значения входов при последнем пересчёте в @ref update, по позициям @ref ports.
+    vector<uint64_t> seenVersion; ///< Версии потоков на момент последнего @ref update.
+    vector<char> dirty;         ///< Рабочая пометка изменившихся потоков.
+    vector<char> neverRun;      ///< Устройство расписания ещё не пересчитывалось в @ref update.
+
+    vector<Block> blocks;       ///< Компоненты в топологическом порядке.
+
+    /**
+     * @struct RecycleWork
+     * @brief Рабочие массивы @ref solveBlock; сохраняются между вызовами, чтобы
+     *        повторное сведение рециклов не выделяло память.
+     */
+    struct RecycleWork
+    {
+        vector<double> x, g, xPrev, gPrev, f, fPrev; ///< Приближение, его образ, невязка и их прошлые значения.
+        vector<double> dF, dG, a, rhs;               ///< История и система метода Андерсона.
+    };
+    RecycleWork work;           ///< Рабочие массивы рециклов.
+    bool blocksReady = false;   ///< Актуален ли @ref blocks.
+
+    unordered_map<string_view, StreamId> streamByName; ///< Имя (строка @ref GlobalNames или @ref defaultNames) → номер потока.
+    unordered_map<string_view, size_t> deviceByName;   ///< Имя → индекс устройства.
+    deque<string> defaultNames; ///< Сформированные для индекса имена по умолчанию «s<номер>».
+    bool namesReady = false;    ///< Актуальны ли индексы имён.
+
+    /**
+     * @brief Строит индексы имён; при совпадении имён находится первый по порядку объект.
+     *
+     * Имена по умолчанию не хранятся в @ref GlobalNames, поэтому для индекса они
+     * формируются в @ref defaultNames и освобождаются вместе со схемой.
+     */
+    void buildNames() {
+        streamByName.clear();
+        deviceByName.clear();
+        defaultNames.clear();
+        streamByName.reserve(streams.size());
+        for (size_t i = 0; i < streams.size(); i++) {
+            const uint32_t id = streams[i]->getNameId();
+            string_view name;
+            if (id & GlobalNames::NUMBERED) {
+                defaultNames.push_back(GlobalNames::format(id));
+                name = defaultNames.back();
+            } else {
+                name = GlobalNames::get(id);
+            }
+            streamByName.emplace(name, static_cast<StreamId>(i));
+        }
+        for (size_t d = 0; d < devices.size(); d++)
+            if (devices[d]->getNameId() != 0) deviceByName.emplace(devices[d]->getName(), d);
+        namesReady = true;
+    }
+
+    /**
+     * @brief Находит сильно связные компоненты графа устройств (итеративный алгоритм Тарьяна).
+     * @return Компоненты в топологическом порядке; каждая — индексы устройств.
+     */
+    vector<vector<size_t>> stronglyConnected() const {
+        const size_t n = devices.size(), none = SIZE_MAX;
+        vector<size_t> index(n, none), low(n, 0), stack;
+        vector<char> onStack(n, 0);
+        vector<pair<size_t, size_t>> call; // (устройство, следующая дуга)
+        vector<vector<size_t>> sccs;
+        size_t counter = 0;
+
+        for (size_t root = 0; root < n; root++) {
+            if (index[root] != none) continue;
+            index[root] = low[root] = counter++;
+            stack.push_back(root); onStack[root] = 1;
+            call.push_back({root, 0});
+            while (!call.empty()) {
+                size_t v = call.back().first;
+                size_t& e = call.back().second;
+                if (e < consumers[v].size()) {
+                    size_t w = consumers[v][e++];
+                    if (index[w] == none) {
+                        index[w] = low[w] = counter++;
+                        stack.push_back(w); onStack[w] = 1;
+                        call.push_back({w, 0});
+                    } else if (onStack[w]) {
+                        low[v] = min(low[v], index[w]);
+                    }
+                    continue;
+                }
+                if (low[v] == index[v]) {
+                    sccs.emplace_back();
+                    size_t w;
+                    do {
+                        w = stack.back(); stack.pop_back(); onStack[w] = 0;
+                        sccs.back().push_back(w);
+                    } while (w != v);
+                }
+                call.pop_back();
+                if (!call.empty()) low[call.back().first] = min(low[call.back().first], low[v]);
+            }
+        }
+        reverse(sccs.begin(), sccs.end());
+        return sccs;
+    }
+
+    /**
+     * @brief Разбивает схему на компоненты и выбирает разрываемые потоки в рециклах.
+     *
+     * Внутри компоненты выполняется обход в глубину от устройства с наименьшим
+     * индексом; потоки на обратных дугах становятся разрываемыми, а обратный
+     * порядок выхода из обхода задаёт порядок пересчёта.
+     */
+    void buildBlocks() {
+        buildGraph();
+        unordered_map<const Stream*, vector<size_t>> readers;
+        for (size_t d = 0; d < devices.size(); d++)
+            for (const auto& s : devices[d]->inputsView()) readers[s].push_back(d);
+
+        vector<vector<pair<size_t, Stream*>>> edges(devices.size()); // (потребитель, поток)
+        for (size_t d = 0; d < devices.size(); d++)
+            for (const auto& s : devices[d]->outputsView())
+                for (size_t r : readers[s]) edges[d].push_back({r, s});
+
+        const auto sccs = stronglyConnected();
+        vector<size_t> blockOf(devices.size());
+        for (size_t b = 0; b < sccs.size(); b++)
+            for (size_t d : sccs[b]) blockOf[d] = b;
+
+        blocks.assign(sccs.size(), {});
+        vector<char> state(devices.size(), 0); // 0 — не посещено, 1 — на пути обхода, 2 — обработано
+        for (size_t b = 0; b < sccs.size(); b++) {
+            const auto& scc = sccs[b];
+            const size_t d0 = *min_element(scc.begin(), scc.end());
+            bool selfLoop = false;
+            for (size_t c : consumers[d0]) selfLoop = selfLoop || c == d0;
+            if (scc.size() == 1 && !selfLoop) {
+                blocks[b].devices.push_back(devices[d0].get());
+                continue;
+            }
+
+            unordered_set<Stream*> torn;
+            vector<size_t> post;
+            vector<pair<size_t, size_t>> call{{d0, 0}}; // (устройство, следующая дуга в edges)
+            state[d0] = 1;
+            while (!call.empty()) {
+                size_t v = call.back().first;
+                size_t& e = call.back().second;
+                bool descended = false;
+                while (!descended && e < edges[v].size()) {
+                    auto [w, st] = edges[v][e++];
+                    if (blockOf[w] != b) continue;
+                    if (state[w] == 1) torn.insert(st);
+                    else if (state[w] == 0) { state[w] = 1; call.push_back({w, 0}); descended = true; }
+                }
+                if (descended) continue;
+                state[v] = 2;
+                post.push_back(v);
+                call.pop_back();
+            }
+
+            for (auto it = post.rbegin(); it != post.rend(); ++it)
+                blocks[b].devices.push_back(devices[*it].get());
+            for (size_t d : post)
+                for (const auto& s : devices[d]->outputsView())
+                    if (torn.erase(s)) blocks[b].tears.push_back(s);
+        }
+        blocksReady = true;
+    }
+
+    /**
+     * @brief Число переменных разрыва: по одной на поток без состава, по компоненту — на поток с составом.
+     */
+    static size_t tearWidth(const Block& block) {
+        size_t n = 0;
+        for (const Stream* t : block.tears) n += max<size_t>(t->componentCount(), 1);
+        return n;
+    }
+
+    /**
+     * @brief Читает переменные разрыва из потоков в @p x.
+     */
+    static void gatherTears(const Block& block, double* x) {
+        for (const Stream* t : block.tears) {
+            const size_t c = t->componentCount();
+            if (c == 0) { *x++ = t->getMassFlow(); continue; }
+            copy(t->componentData(), t->componentData() + c, x);
+            x += c;
+        }
+    }
+
+    /**
+     * @brief Записывает переменные разрыва из @p x в потоки; суммарный расход
+     *        потока с составом становится суммой компонентов.
+     */
+    static void scatterTears(const Block& block, const double* x) {
+        for (Stream* t : block.tears) {
+            const size_t c = t->componentCount();
+            if (c == 0) { t->setMassFlow(*x++); continue; }
+            copy(x, x + c, t->componentData());
+            t->commitComponents();
+            x += c;
+        }
+    }
+
+    /**
+     * @brief Сводит один рецикл методом простой итерации с выбранным ускорением.
+     *
+     * У разрываемых потоков с составом итерируются и проверяются на сходимость
+     * расходы компонентов, у остальных — суммарный расход. Если после подстановки
+     * у разрыва появился состав (обычно на первой итерации), история ускорения
+     * сбрасывается и итерации продолжаются простой подстановкой.
+     * @param block Циклическая компонента.
+     * @param opt Настройки решателя.
+     * @param report Отчёт, в который добавляются итерации и невязка.
+     */
+    void solveBlock(const Block& block, const RecycleOptions& opt, RecycleReport& report) {
+        const size_t depth = static_cast<size_t>(max(opt.andersonDepth, 1));
+        auto& [x, g, xPrev, gPrev, f, fPrev, dF, dG, a, rhs] = work;
+        size_t m = 0, history = 0, newest = 0, since = 0; // since — итерации с последней раскладки переменных
+        auto layout = [&] {
+            m = tearWidth(block);
+            for (vector<double>* v : {&x, &g, &xPrev, &gPrev, &f, &fPrev}) v->assign(m, 0.0);
+            dF.assign(m * depth, 0.0); dG.assign(m * depth, 0.0);
+            a.assign(depth * depth, 0.0); rhs.assign(depth, 0.0);
+            history = newest = since = 0;
+            gatherTears(block, x.data());
+        };
+        layout();
+
+        double residual = 0.0;
+        int it = 0;
+        bool converged = false;
+        const TraceScope loop("Recycle loop");
+        while (it < opt.maxIterations) {
+            it++;
+            since++;
+            const TraceScope step("Recycle iteration", nullptr, it);
+            scatterTears(block, x.data());
+            for (Device* d : block.devices) d->profiledUpdate();
+            if (tearWidth(block) != m) {
+                layout();
+                residual = numeric_limits<double>::infinity();
+                continue;
+            }
+
+            gatherTears(block, g.data());
+            residual = 0.0;
+            for (size_t i = 0; i < m; i++) {
+                f[i] = g[i] - x[i];
+                residual = max(residual, fabs(f[i]) / max(1.0, fabs(g[i])));
+            }
+            if (residual <= opt.tolerance) { converged = true; break; }
+
+            if (opt.method == RecycleMethod::Wegstein && since > 1) {
+                for (size_t i = 0; i < m; i++) {
+                    double dx = x[i] - xPrev[i];
+                    double q = 0.0;
+                    if (dx != 0.0) {
+                        double slope = (g[i] - gPrev[i]) / dx;
+                        if (slope != 1.0) q = min(max(slope / (slope - 1.0), opt.wegsteinMin), opt.wegsteinMax);
+                    }
+                    xPrev[i] = x[i];
+                    x[i] = q * x[i] + (1.0 - q) * g[i];
+                }
+            } else if (opt.method == RecycleMethod::Anderson && since > 1) {
+                newest = history < depth ? history : (newest + 1) % depth;
+                for (size_t i = 0; i < m; i++) {
+                    dF[newest*m + i] = f[i] - fPrev[i];
+                    dG[newest*m + i] = g[i] - gPrev[i];
+                }
+                history = min(history + 1, depth);
+                for (size_t p = 0; p < history; p++) {
+                    rhs[p] = 0.0;
+                    for (size_t i = 0; i < m; i++) rhs[p] += dF[p*m + i] * f[i];
+                    for (size_t q = 0; q < history; q++) {
+                        double dot = 0.0;
+                        for (size_t i = 0; i < m; i++) dot += dF[p*m + i] * dF[q*m + i];
+                        a[p*history + q] = dot + (p == q ? 1e-12 : 0.0);
+                    }
+                }
+                bool ok = solveDense(a.data(), rhs.data(), history);
+                for (size_t i = 0; i < m; i++) {
+                    xPrev[i] = x[i];
+                    x[i] = g[i];
+                    if (ok)
+                        for (size_t p = 0; p < history; p++) x[i] -= dG[p*m + i] * rhs[p];
+                }
+            } else {
+                xPrev = x;
+                x = g;
+            }
+            gPrev = g;
+            fPrev = f;
+        }
+
+        report.iterations += it;
+        report.residual = max(report.residual, residual);
+        report.converged = report.converged && converged;
+    }
+
+    /**
+     * @brief Строит граф устройств по их входам и выходам.
+     *
+     * Каждый поток может иметь не более одного производителя. Потоки, найденные
+     * в портах устройств, но не добавленные через @ref addStream, регистрируются автоматически.
+     */
+    void buildGraph() {
+        const size_t known0 = streams.size();
+        unordered_map<const Stream*, size_t> producer;
+        unordered_set<const Stream*> known;
+        for (const auto& s : streams) known.insert(s.get());
+
+        for (size_t d = 0; d < devices.size(); d++) {
+            for (const auto& s : devices[d]->outputsView()) {
+                if (!producer.emplace(s, d).second) {
+                    throw "Stream " + s->getName() + " has several producers";
+                }
+                if (known.insert(s).second) streams.push_back(devices[d]->share(s));
+            }
+        }
+
+        consumers.assign(devices.size(), {});
+        for (size_t d = 0; d < devices.size(); d++) {
+            for (const auto& s : devices[d]->inputsView()) {
+                auto p = producer.find(s);
+                if (p != producer.end()) consumers[p->second].push_back(d);
+                if (known.insert(s).second) streams.push_back(devices[d]->share(s));
+            }
+        }
+
+        streamIds.clear();
+        for (size_t i = 0; i < streams.size(); i++) {
+            streamIds.emplace(streams[i].get(), static_cast<StreamId>(i));
+        }
+        if (streams.size() != known0) namesReady = false;
+    }
+
+    /**
+     * @brief Раскладывает порты устройств из @ref order в плотный массив номеров потоков.
+     */
+    void buildPorts() {
+        ports.clear();
+        portOffsets.assign(1, 0);
+        for (Device* d : order) {
+            for (const auto& s : d->inputsView()) ports.push_back(streamIds.at(s));
+            portOffsets.push_back(ports.size());
+            for (const auto& s : d->outputsView()) ports.push_back(streamIds.at(s));
+            portOffsets.push_back(ports.size());
+        }
+    }
+
+    /**
+     * @brief Добавляет в схему поток, размещённый в @ref streamArena.
+     */
+    StreamId addPooled(Stream& s, double mass_flow) {
+        s.setMassFlow(mass_flow);
+        streams.push_back(shared_ptr<Stream>(streamArena, &s));
+        scheduled = false;
+        blocksReady = false;
+        namesReady = false;
+        return static_cast<StreamId>(streams.size() - 1);
+    }
+
+public:
+    /**
+     * @brief Добавляет поток в схему.
+     * @param s Умный указатель на поток.
+     * @return Тот же указатель, для удобной цепочки вызовов.
+     */
+    shared_ptr<Stream> addStream(shared_ptr<Stream> s) {
+        streams.push_back(s);
+        scheduled = false;
+        blocksReady = false;
+        namesReady = false;
+        return s;
+    }
+
+    /**
+     * @brief Добавляет устройство в схему. Порты можно подключать и после добавления.
+     * @param d Умный указатель на устройство.
+     * @return Тот же указатель, для удобной цепочки вызовов.
+     */
+    shared_ptr<Device> addDevice(shared_ptr<Device> d) {
+        devices.push_back(d);
+        scheduled = false;
+        blocksReady = false;
+        namesReady = false;
+        return d;
+    }
+
+    /**
+     * @brief Создаёт поток в пуле схемы.
+     *
+     * Поток размещается в блоке @ref ObjectPool без отдельного выделения памяти.
+     * Запись в @ref getStreams разделяет один счётчик ссылок на весь пул; порты,
+     * подключённые через @ref connectInput / @ref connectOutput, хранят простой
+     * указатель и счётчик не трогают. Номер стабилен и совпадает с номером
+     * строки в @ref loadTable.
+     * @param mass_flow Начальный массовый расход.
+     * @return Номер (дескриптор) потока.
+     */
+    StreamId newStream(double mass_flow = 0.0) {
+        if (!streamArena) streamArena = make_shared<ObjectPool<Stream>>();
+        return addPooled(streamArena->emplace(static_cast<int>(streams.size() + 1)), mass_flow);
+    }
+
+    /**
+     * @brief Создаёт в пуле схемы поток с заданным именем (см. @ref newStream(double)).
+     * @param name Имя потока.
+     * @param mass_flow Начальный массовый расход.
+     * @return Номер (дескриптор) потока.
+     */
+    StreamId newStream(string_view name, double mass_flow) {
+        if (!streamArena) streamArena = make_shared<ObjectPool<Stream>>();
+        return addPooled(streamArena->emplace(name), mass_flow);
+    }
+
+    /**
+     * @brief Создаёт миксер в пуле схемы и добавляет его в схему.
+     * @param inputs_count Максимально допустимое число входных потоков.
+     * @return Ссылка на миксер; действительна, пока жива схема или указатели на её устройства.
+     */
+    Mixer& newMixer(int inputs_count) {
+        if (!deviceArena) deviceArena = make_shared<DeviceArena>();
+        Mixer& m = deviceArena->mixers.emplace(inputs_count);
+        addDevice(shared_ptr<Device>(deviceArena, &m));
+        return m;
+    }
+
+    /**
+     * @brief Создаёт реактор в пуле схемы и добавляет его в схему.
+     * @param isDoubleReactor Если @c true — два выхода, иначе один.
+     * @return Ссылка на реактор; действительна, пока жива схема или указатели на её устройства.
+     */
+    Reactor& newReactor(bool isDoubleReactor) {
+        if (!deviceArena) deviceArena = make_shared<DeviceArena>();
+        Reactor& r = deviceArena->reactors.emplace(isDoubleReactor);
+        addDevice(shared_ptr<Device>(deviceArena, &r));
+        return r;
+    }
+
+    /**
+     * @brief Подключает поток схемы ко входу устройства без разделения владения:
+     *        устройство не должно пережить схему.
+     * @param d Устройство.
+     * @param id Номер потока.
+     */
+    void connectInput(Device& d, StreamId id) {
+        d.attachInput(streams.at(id).get());
+        scheduled = false;
+        blocksReady = false;
+    }
+
+    /**
+     * @brief Подключает поток схемы к выходу устройства (см. @ref connectInput).
+     * @param d Устройство.
+     * @param id Номер потока.
+     */
+    void connectOutput(Device& d, StreamId id) {
+        d.attachOutput(streams.at(id).get());
+        scheduled = false;
+        blocksReady = false;
+    }
+
+    /**
+     * @brief Поток по номеру.
+     * @param id Номер потока.
+     */
+    Stream& stream(StreamId id) { return *streams[id]; }
+
+    /**
+     * @brief Резервирует место под потоки и устройства, чтобы сборка большой схемы не перераспределяла списки.
+     * @param streamCount Ожидаемое число потоков.
+     * @param deviceCount Ожидаемое число устройств.
+     */
+    void reserve(size_t streamCount, size_t deviceCount) {
+        streams.reserve(streamCount);
+        devices.reserve(deviceCount);
+    }
+
+    /**
+     * @brief Сбрасывает построенное расписание и индексы имён; вызывать после
+     *        переподключения портов или переименования потоков и устройств.
+     */
+    void invalidate() { scheduled = false; blocksReady = false; namesReady = false; }
+
+    /**
+     * @brief Ищет поток по имени за O(1) по хеш-индексу.
+     *
+     * Индекс строится при первом поиске после изменения состава схемы, дальше
+     * поиск только читает его и может выполняться из нескольких потоков.
+     * Потоки, известные лишь по портам устройств, индексируются после @ref schedule.
+     * @param name Имя потока.
+     * @return Номер потока либо @ref NO_STREAM.
+     */
+    StreamId findStream(string_view name) {
+        if (!namesReady) buildNames();
+        auto it = streamByName.find(name);
+        return it == streamByName.end() ? NO_STREAM : it->second;
+    }
+
+    /**
+     * @brief Ищет устройство по имени (см. @ref findStream).
+     * @param name Имя устройства.
+     * @return Устройство либо @c nullptr.
+     */
+    Device* findDevice(string_view name) {
+        if (!namesReady) buildNames();
+        auto it = deviceByName.find(name);
+        return it == deviceByName.end() ? nullptr : devices[it->second].get();
+    }
+
+    /**
+     * @brief Возвращает устройства схемы в порядке добавления.
+     */
+    const vector<shared_ptr<Device>>& getDevices() const { return devices; }
+
+    /**
+     * @brief Возвращает потоки схемы.
+     */
+    const vector<shared_ptr<Stream>>& getStreams() const { return streams; }
+
+    /**
+     * @brief Строит (при необходимости) и возвращает топологический порядок устройств.
+     *
+     * Используется алгоритм Кана; при равных условиях сохраняется порядок добавления.
+     * @return Устройства в порядке, в котором их нужно пересчитывать.
+     * @throw std::string Если в схеме есть рецикл или у потока несколько производителей.
+     */
+    const vector<Device*>& schedule() {
+        if (scheduled) return order;
+
+        buildGraph();
+        vector<size_t> indegree(devices.size(), 0);
+        for (const auto& next : consumers)
+            for (size_t c : next) indegree[c]++;
+
+        vector<size_t>& ready = orderIndex;
+        ready.clear();
+        for (size_t d = 0; d < devices.size(); d++)
+            if (indegree[d] == 0) ready.push_back(d);
+
+        order.clear();
+        for (size_t head = 0; head < ready.size(); head++) {
+            size_t d = ready[head];
+            order.push_back(devices[d].get());
+            for (size_t c : consumers[d])
+                if (--indegree[c] == 0) ready.push_back(c);
+        }
+
+        if (order.size() != devices.size()) {
+            order.clear();
+            throw "Flowsheet contains a recycle loop"s;
+        }
+        buildPorts();
+        seenInputs.assign(ports.size(), 0.0);
+        seenVersion.assign(streams.size(), 0);
+        dirty.assign(streams.size(), 0);
+        neverRun.assign(order.size(), 1);
+        scheduled = true;
+        return order;
+    }
+
+    /**
+     * @brief Разбивает расписание на уровни: устройство попадает на уровень на
+     *        единицу глубже самого глубокого из своих производителей, поэтому
+     *        устройства одного уровня друг от друга не зависят.
+     * @return Для каждого уровня — позиции устройств в @ref schedule по возрастанию.
+     */
+    vector<vector<size_t>> levels() {
+        schedule();
+        vector<size_t> pos(devices.size()), depth(order.size(), 0);
+        for (size_t k = 0; k < order.size(); k++) pos[orderIndex[k]] = k;
+
+        vector<vector<size_t>> result;
+        for (size_t k = 0; k < order.size(); k++) {
+            for (size_t c : consumers[orderIndex[k]])
+                depth[pos[c]] = max(depth[pos[c]], depth[k] + 1);
+            if (depth[k] >= result.size()) result.resize(depth[k] + 1);
+            result[depth[k]].push_back(k);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Возвращает номер потока в таблице, заполняемой @ref loadTable.
+     * @param s Поток схемы.
+     * @throw std::out_of_range Если поток не принадлежит схеме.
+     */
+    StreamId streamId(const Stream* s) {
+        schedule();
+        return streamIds.at(s);
+    }
+
+    /**
+     * @brief Заполняет таблицу потоками схемы; номер строки совпадает с индексом в @ref getStreams.
+     * @param table Таблица, содержимое которой заменяется.
+     */
+    void loadTable(StreamTable& table) {
+        schedule();
+        table.clear();
+        for (const auto& s : streams) {
+            table.add(*s);
+        }
+    }
+
+    /**
+     * @brief Пересчитывает схему над плотным массивом расходов таблицы, не трогая объекты @ref Stream.
+     * @param table Таблица, заполненная @ref loadTable.
+     */
+    void runTable(StreamTable& table) {
+        schedule();
+        double* flows = table.data();
+        for (size_t k = 0; k < order.size(); k++) {
+            auto in = inputIds(k), out = outputIds(k);
+            order[k]->profiled([&] { order[k]->updateTable(flows, in.data(), in.size(), out.data(), out.size()); });
+        }
+    }
+
+    /**
+     * @brief Номера входных потоков k-го устройства расписания.
+     * @param k Позиция устройства в @ref schedule.
+     */
+    PortView<StreamId> inputIds(size_t k) const {
+        return {ports.data() + portOffsets[2*k], ports.data() + portOffsets[2*k+1]};
+    }
+
+    /**
+     * @brief Номера выходных потоков k-го устройства расписания.
+     * @param k Позиция устройства в @ref schedule.
+     */
+    PortView<StreamId> outputIds(size_t k) const {
+        return {ports.data() + portOffsets[2*k+1], ports.data() + portOffsets[2*k+2]};
+    }
+
+    /**
+     * @brief Переносит расходы из таблицы обратно в объекты @ref Stream.
+     * @param table Таблица, заполненная @ref loadTable.
+     */
+    void storeTable(const StreamTable& table) {
+        schedule();
+        for (size_t i = 0; i < streams.size(); i++) {
+            streams[i]->setMassFlow(table.getMassFlow(static_cast<StreamId>(i)));
+        }
+    }
+
+    /**
+     * @brief Пересчитывает все устройства схемы за один проход в топологическом порядке.
+     */
+    void run() {
+        const TraceScope trace("Flowsheet::run");
+        for (Device* d : schedule()) {
+            d->profiledUpdate();
+        }
+    }
+
+    /**
+     * @brief Печатает подключения устройств и расходы потоков схемы.
+     * @param os Поток вывода.
+     */
+    void print(ostream& os = cout) const {
+        for (size_t d = 0; d < devices.size(); d++) {
+            os << "Device " << d << ":";
+            for (const auto& s : devices[d]->inputsView()) os << " " << s->getName();
+            os << " ->";
+            for (const auto& s : devices[d]->outputsView()) os << " " << s->getName();
+            os << "\n";
+        }
+        for (const auto& s : streams) {
+            os << "Stream " << s->getName() << " flow = " << s->getMassFlow() << "\n";
+        }
+    }
+
+    /**
+     * @brief Таблица статистики пересчётов устройств (сборка с DEVICE_PROFILING).
+     * @return По строке на устройство в порядке добавления; без DEVICE_PROFILING счётчики нулевые.
+     */
+    vector<DeviceProfile> profile() const {
+        const double k = PROFILING_ENABLED ? ProfileClock::nanosPerTick() : 0.0;
+        vector<DeviceProfile> table(devices.size());
+        for (size_t d = 0; d < devices.size(); d++) {
+            const DeviceCounters c = devices[d]->counters();
+            table[d] = {d, devices[d]->typeName(), c.calls, c.exceptions,
+                        double(c.totalTicks) * k, double(c.maxTicks) * k};
+        }
+        return table;
+    }
+
+    /**
+     * @brief Обнуляет статистику всех устройств схемы.
+     */
+    void resetProfile() {
+        for (const auto& d : devices) d->resetCounters();
+    }
+
+    /**
+     * @brief Подписывает участки устройств схемы в трассе как «Вид индекс».
+     * @param tracer Трассировщик.
+     */
+    void labelTrace(Tracer& tracer) const {
+        for (size_t d = 0; d < devices.size(); d++)
+            tracer.setLabel(devices[d].get(), devices[d]->typeName() + " "s + to_string(d));
+    }
+
+    /**
+     * @brief Печатает статистику пересчётов устройств.
+     * @param os Поток вывода.
+     * @param format Текстовая таблица или CSV.
+     */
+    void printProfile(ostream& os = cout, ProfileFormat format = ProfileFormat::Text) const {
+        auto table = profile();
+        if (format == ProfileFormat::Csv) {
+            os << "device,type,calls,exceptions,total_ns,max_ns\n";
+            for (const auto& p : table) {
+                os << p.device << "," << p.type << "," << p.calls << "," << p.exceptions << ","
+                   << p.totalNs << "," << p.maxNs << "\n";
+            }
+            return;
+        }
+        stable_sort(table.begin(), table.end(),
+                    [](const DeviceProfile& a, const DeviceProfile& b) { return a.totalNs > b.totalNs; });
+        for (const auto& p : table) {
+            os << "Device " << p.device << " " << p.type << ": calls = " << p.calls
+               << ", exceptions = " << p.exceptions << ", total = " << p.totalNs
+               << " ns, max = " << p.maxNs << " ns\n";
+        }
+    }
+
+    /**
+     * @brief Инкрементальный пересчёт: только устройства ниже по потоку от изменившихся потоков.
+     *
+     * Поток считается изменившимся, если его версия (@ref Stream::getVersion)
+     * отличается от запомненной при прошлом вызове. Устройство пересчитывается,
+     * если изменился хотя бы один его вход и значения входов побитово отличаются от
+     * прошлого пересчёта (для входов с составом достаточно изменения версии);
+     * после пересчёта его выходы помечаются изменившимися.
+     * Первый вызов после построения расписания пересчитывает все устройства.
+     * @return Число пересчитанных устройств.
+     */
+    size_t update() {
+        const TraceScope trace("Flowsheet::update");
+        schedule();
+        for (size_t i = 0; i < streams.size(); i++)
+            dirty[i] = streams[i]->getVersion() != seenVersion[i];
+
+        size_t evaluated = 0;
+        for (size_t k = 0; k < order.size(); k++) {
+            const auto in = inputIds(k);
+            bool touched = neverRun[k];
+            for (StreamId id : in) touched = touched || dirty[id];
+            if (!touched) continue;
+
+            bool same = !neverRun[k];
+            double* seen = seenInputs.data() + portOffsets[2*k];
+            for (size_t j = 0; j < in.size(); j++) {
+                const Stream& input = *streams[in[j]];
+                double v = input.getMassFlow();
+                // Состав может измениться при том же суммарном расходе: такой вход
+                // считается изменившимся по версии, без сравнения значений.
+                same = same && input.componentCount() == 0 && memcmp(&v, &seen[j], sizeof v) == 0;
+                seen[j] = v;
+            }
+            if (same) continue;
+
+            order[k]->profiledUpdate();
+            neverRun[k] = 0;
+            evaluated++;
+            for (StreamId id : outputIds(k)) dirty[id] = 1;
+        }
+
+        for (size_t i = 0; i < streams.size(); i++)
+            seenVersion[i] = streams[i]->getVersion();
+        return evaluated;
+    }
+
+    /**
+     * @brief Пересчитывает схему с рециклами.
+     *
+     * Схема разбивается на сильно связные компоненты; ациклические устройства
+     * пересчитываются один раз, а каждый рецикл сводится итерациями по
+     * автоматически выбранным разрываемым потокам. Начальное приближение —
+     * текущие расходы разрываемых потоков.
+     * @param opt Метод и параметры сходимости.
+     * @return Отчёт о сходимости.
+     */
+    RecycleReport solve(const RecycleOptions& opt = RecycleOptions()) {
+        const TraceScope trace("Flowsheet::solve");
+        if (!blocksReady) buildBlocks();
+        RecycleReport report;
+        for (const auto& block : blocks) {
+            if (block.tears.empty()) {
+                for (Device* d : block.devices) d->profiledUpdate();
+                continue;
+            }
+            report.loops++;
+            report.tears += static_cast<int>(block.tears.size());
+            solveBlock(block, opt, report);
+        }
+        return report;
+    }
+
+    /**
+     * @brief Возвращает разрываемые потоки всех рециклов схемы.
+     */
+    vector<Stream*> tearStreams() {
+        if (!blocksReady) buildBlocks();
+        vector<Stream*> result;
+        for (const auto& block : blocks)
+            result.insert(result.end(), block.tears.begin(), block.tears.end());
+        return result;
+    }
+
+    /**
+     * @brief Порядок пересчёта устройств, в котором их обходит @ref solve: компоненты
+     *        в топологическом порядке, внутри рецикла — порядок без разорванных дуг.
+     */
+    vector<Device*> evaluationOrder() {
+        if (!blocksReady) buildBlocks();
+        vector<Device*> result;
+        for (const auto& block : blocks)
+            result.insert(result.end(), block.devices.begin(), block.devices.end());
+        return result;
+    }
+};
+
+
+/**
+ * @brief Сумма расходов @p flows по номерам @p idx.
+ *
+ * При сборке с AVX2 (@c DEVICE_ENABLE_AVX2) складывает по четыре расхода за
+ * инструкцию через @c _mm256_i32gather_pd, иначе — обычный скалярный цикл.
+ * Номера потоков должны помещаться в @c int32.
+ * @param flows Массив расходов.
+ * @param idx Номера слагаемых.
+ * @param n Количество слагаемых.
+ */
+inline double gatherSum(const double* flows, const StreamId* idx, size_t n) {
+    size_t i = 0;
+    double sum = 0.0;
+#if defined(__AVX2__)
+    __m256d acc = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        __m128i vi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx + i));
+        acc = _mm256_add_pd(acc, _mm256_i32gather_pd(flows, vi, 8));
+    }
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+#endif
+    for (; i < n; i++) {
+        sum += flows[idx[i]];
+    }
+    return sum;
+}
+
+
+/**
+ * @class MixerBatch
+ * @brief Пакетный пересчёт множества миксеров над @ref StreamTable.
+ *
+ * Входы всех миксеров лежат в формате CSR (@ref rowPtr / @ref colIdx), выходы —
+ * аналогично в @ref outPtr / @ref outIdx. Строки пересчитываются в порядке
+ * добавления, поэтому миксеры должны добавляться в топологическом порядке.
+ */
+class MixerBatch
+{
+private:
+    vector<uint32_t> rowPtr{0}; ///< Начала списков входов миксеров в @ref colIdx.
+    vector<StreamId> colIdx;    ///< Номера входных потоков всех миксеров подряд.
+    vector<uint32_t> outPtr{0}; ///< Начала списков выходов миксеров в @ref outIdx.
+    vector<StreamId> outIdx;    ///< Номера выходных потоков всех миксеров подряд.
+
+public:
+    /**
+     * @brief Добавляет миксер в пакет.
+     * @param in Номера входных потоков.
+     * @param out Номера выходных потоков.
+     */
+    void add(PortView<StreamId> in, PortView<StreamId> out) {
+        if (out.empty()) {
+            throw "Should set outputs before update"s;
+        }
+        colIdx.insert(colIdx.end(), in.begin(), in.end());
+        rowPtr.push_back(static_cast<uint32_t>(colIdx.size()));
+        outIdx.insert(outIdx.end(), out.begin(), out.end());
+        outPtr.push_back(static_cast<uint32_t>(outIdx.size()));
+    }
+
+    /**
+     * @brief Собирает пакет из всех миксеров схемы в порядке её расписания.
+     * @param fs Схема из устройств ровно типа @ref Mixer; номера потоков
+     *           соответствуют @ref Flowsheet::loadTable.
+     * @throw std::string Если в схеме есть устройство другого типа (в том числе
+     *        наследник @ref Mixer): пакет пересчитал бы схему без него.
+     */
+    void build(Flowsheet& fs) {
+        clear();
+        const auto& order = fs.schedule();
+        for (size_t k = 0; k < order.size(); k++) {
+            if (typeid(*order[k]) != typeid(Mixer)) {
+                clear();
+                throw "MixerBatch supports only Mixer devices"s;
+            }
+            add(fs.inputIds(k), fs.outputIds(k));
+        }
+    }
+
+    /**
+     * @brief Очищает пакет.
+     */
+    void clear() {
+        rowPtr.assign(1, 0); colIdx.clear();
+        outPtr.assign(1, 0); outIdx.clear();
+    }
+
+    /**
+     * @brief Количество миксеров в пакете.
+     */
+    size_t size() const { return rowPtr.size() - 1; }
+
+    /**
+     * @brief Пересчитывает все миксеры пакета.
+     * @param flows Массив расходов @ref StreamTable.
+     */
+    void evaluate(double* flows) const {
+        const size_t rows = size();
+        for (size_t r = 0; r < rows; r++) {
+            const uint32_t b = rowPtr[r];
+            const double sum = gatherSum(flows, colIdx.data() + b, rowPtr[r+1] - b);
+            const uint32_t ob = outPtr[r], oe = outPtr[r+1];
+            const double output_mass = sum / (oe - ob);
+            for (uint32_t o = ob; o < oe; o++) {
+                flows[outIdx[o]] = output_mass;
+            }
+        }
+    }
+};
+
+
+/**
+ * @class TypedSchedule
+ * @brief Пересчёт схемы без виртуальных вызовов на горячем пути.
+ *
+ * Расписание разбивается на уровни (@ref Flowsheet::levels), а внутри уровня
+ * устройства раскладываются по корзинам точного типа. Для корзин @ref Mixer и
+ * @ref Reactor метод вызывается с квалификацией типа, то есть статически и с
+ * возможностью встраивания; прочие устройства и наследники идут через vtable.
+ */
+class TypedSchedule
+{
+private:
+    /**
+     * @struct Level
+     * @brief Независимые устройства одного уровня, разложенные по типам.
+     */
+    struct Level
+    {
+        vector<Mixer*> mixers;                    ///< Устройства ровно типа @ref Mixer.
+        MixerBatch mixerBatch;                    ///< Те же миксеры для табличного режима.
+        vector<pair<Reactor*, size_t>> reactors;  ///< Устройства ровно типа @ref Reactor и их позиции в расписании.
+        vector<pair<Device*, size_t>> others;     ///< Остальные устройства и их позиции в расписании.
+    };
+    vector<Level> levels;           ///< Уровни в порядке пересчёта.
+
+public:
+    /**
+     * @brief Строит уровни и корзины по схеме.
+     * @param fs Ациклическая схема.
+     */
+    void build(Flowsheet& fs) {
+        levels.clear();
+        const auto& order = fs.schedule();
+        for (const auto& positions : fs.levels()) {
+            levels.emplace_back();
+            Level& level = levels.back();
+            for (size_t k : positions) {
+                Device* d = order[k];
+                if (typeid(*d) == typeid(Mixer)) {
+                    level.mixers.push_back(static_cast<Mixer*>(d));
+                    level.mixerBatch.add(fs.inputIds(k), fs.outputIds(k));
+                } else if (typeid(*d) == typeid(Reactor)) {
+                    level.reactors.push_back({static_cast<Reactor*>(d), k});
+                } else {
+                    level.others.push_back({d, k});
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Количество уровней.
+     */
+    size_t levelCount() const { return levels.size(); }
+
+    /**
+     * @brief Пересчитывает схему над объектами @ref Stream.
+     */
+    void run() const {
+        for (const auto& level : levels) {
+            for (Mixer* m : level.mixers) m->profiled([m] { m->Mixer::updateOutputs(); });
+            for (const auto& [r, k] : level.reactors) r->profiled([r = r] { r->Reactor::updateOutputs(); });
+            for (const auto& [d, k] : level.others) d->profiledUpdate();
+        }
+    }
+
+    /**
+     * @brief Пересчитывает схему над массивом расходов @ref StreamTable.
+     * @param fs Схема, по которой построено расписание (для портов прочих устройств).
+     * @param flows Массив расходов, заполненный @ref Flowsheet::loadTable.
+     */
+    void runTable(const Flowsheet& fs, double* flows) const {
+        for (const auto& level : levels) {
+            level.mixerBatch.evaluate(flows);
+            for (const auto& [r, k] : level.reactors) {
+                auto in = fs.inputIds(k), out = fs.outputIds(k);
+                r->profiled([&, r = r] { r->Reactor::updateTable(flows, in.data(), in.size(), out.data(), out.size()); });
+            }
+            for (const auto& [d, k] : level.others) {
+                auto in = fs.inputIds(k), out = fs.outputIds(k);
+                d->profiled([&, d = d] { d->updateTable(flows, in.data(), in.size(), out.data(), out.size()); });
+            }
+        }
+    }
+};
+
+
+/**
+ * @class WorkStealingPool
+ * @brief Пул потоков с очередью задач на каждый поток и кражей работы у соседей.
+ *
+ * Задача — полуинтервал индексов [begin, end) общей функции @ref parallelFor.
+ * Поток берёт задачи с конца своей очереди, а опустев, крадёт с начала чужих.
+ * Вызывающий поток участвует в работе под номером 0.
+ */
+class WorkStealingPool
+{
+private:
+    /**
+     * @struct Queue
+     * @brief Очередь задач одного потока.
+     */
+    struct Queue
+    {
+        mutex lock;                         ///< Защищает @ref tasks.
+        deque<pair<size_t, size_t>> tasks;  ///< Полуинтервалы индексов.
+    };
+
+    vector<unique_ptr<Queue>> queues;       ///< Очереди; нулевая принадлежит вызывающему потоку.
+    vector<thread> workers;                 ///< Рабочие потоки (номера 1..N-1).
+    mutex stateLock;                        ///< Защищает @ref generation и @ref stopping.
+    condition_variable wake;                ///< Будит рабочие потоки при новой порции задач.
+    uint64_t generation = 0;                ///< Номер текущей порции задач.
+    bool stopping = false;                  ///< Пул разрушается.
+    atomic<size_t> pending{0};              ///< Сколько задач текущей порции ещё не выполнено.
+    const function<void(size_t, size_t, size_t)>* job = nullptr; ///< Функция текущей порции: (begin, end, поток).
+    mutex errorLock;                        ///< Защищает @ref error.
+    exception_ptr error;                    ///< Первое исключение, выброшенное задачей.
+
+    /**
+     * @brief Выполняет одну задачу: свою или украденную.
+     * @param self Номер потока.
+     * @return @c false, если задач не нашлось.
+     */
+    bool runOne(size_t self) {
+        pair<size_t, size_t> task;
+        bool found = false;
+        for (size_t k = 0; k < queues.size() && !found; k++) {
+            Queue& q = *queues[(self + k) % queues.size()];
+            lock_guard<mutex> guard(q.lock);
+            if (q.tasks.empty()) continue;
+            if (k == 0) { task = q.tasks.back(); q.tasks.pop_back(); }
+            else { task = q.tasks.front(); q.tasks.pop_front(); }
+            found = true;
+        }
+        if (!found) return false;
+
+        try {
+            (*job)(task.first, task.second, self);
+        } catch (...) {
+            lock_guard<mutex> guard(errorLock);
+            if (!error) error = current_exception();
+        }
+        pending.fetch_sub(1, memory_order_acq_rel);
+        return true;
+    }
+
+    /**
+     * @brief Цикл рабочего потока.
+     * @param self Номер потока.
+     */
+    void workerLoop(size_t self) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> guard(stateLock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            while (pending.load(memory_order_acquire) > 0) {
+                if (!runOne(self)) this_thread::yield();
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Создаёт пул.
+     * @param threads Общее число потоков вместе с вызывающим; 0 — по числу ядер.
+     */
+    explicit WorkStealingPool(size_t threads = 0) {
+        if (threads == 0) threads = max<size_t>(1, thread::hardware_concurrency());
+        for (size_t i = 0; i < threads; i++) queues.push_back(make_unique<Queue>());
+        for (size_t i = 1; i < threads; i++) workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) w.join();
+    }
+
+    /**
+     * @brief Общее число потоков пула вместе с вызывающим.
+     */
+    size_t size() const { return queues.size(); }
+
+    /**
+     * @brief Выполняет @p f над [0, n) кусками по @p grain индексов и ждёт завершения.
+     * @param n Число индексов.
+     * @param grain Размер куска.
+     * @param f Функция над полуинтервалом [begin, end) и номером потока, который его выполняет.
+     * @throw Первое исключение, выброшенное @p f.
+     */
+    void parallelFor(size_t n, size_t grain, const function<void(size_t, size_t, size_t)>& f) {
+        if (n == 0) return;
+        grain = max<size_t>(grain, 1);
+        if (queues.size() == 1 || n <= grain) { f(0, n, 0); return; }
+
+        job = &f;
+        error = nullptr;
+        const size_t chunks = (n + grain - 1) / grain;
+        pending.store(chunks, memory_order_release);
+        for (size_t c = 0; c < chunks; c++) {
+            Queue& q = *queues[c % queues.size()];
+            lock_guard<mutex> guard(q.lock);
+            q.tasks.push_back({c * grain, min(n, (c + 1) * grain)});
+        }
+        {
+            lock_guard<mutex> guard(stateLock);
+            generation++;
+        }
+        wake.notify_all();
+
+        while (pending.load(memory_order_acquire) > 0) {
+            if (!runOne(0)) this_thread::yield();
+        }
+        if (error) rethrow_exception(error);
+    }
+
+    /**
+     * @brief Вариант @ref parallelFor для функций, которым не нужен номер потока.
+     */
+    void parallelFor(size_t n, size_t grain, const function<void(size_t, size_t)>& f) {
+        const function<void(size_t, size_t, size_t)> adapter = [&f](size_t b, size_t e, size_t) { f(b, e); };
+        parallelFor(n, grain, adapter);
+    }
+};
+
+
+/**
+ * @class ParallelExecutor
+ * @brief Параллельный пересчёт схемы по уровням (@ref Flowsheet::levels).
+ *
+ * Устройства одного уровня не зависят друг от друга и пишут только в свои
+ * выходы, поэтому уровень пересчитывается на @ref WorkStealingPool, а между
+ * уровнями стоит барьер. Каждое устройство выполняет те же операции, что и
+ * при последовательном @ref Flowsheet::run, поэтому результат побитово совпадает.
+ */
+class ParallelExecutor
+{
+private:
+    WorkStealingPool pool;          ///< Пул потоков.
+    size_t grain;                   ///< Сколько устройств в одной задаче.
+    vector<vector<Device*>> levels; ///< Устройства по уровням.
+
+public:
+    /**
+     * @brief Создаёт исполнитель.
+     * @param threads Число потоков вместе с вызывающим; 0 — по числу ядер.
+     * @param grain Сколько устройств отдавать потоку за раз; мелкие уровни считаются без пула.
+     */
+    explicit ParallelExecutor(size_t threads = 0, size_t grain = 64): pool(threads), grain(grain) {}
+
+    /**
+     * @brief Строит уровни по ациклической схеме.
+     * @param fs Схема.
+     */
+    void build(Flowsheet& fs) {
+        const auto& order = fs.schedule();
+        levels.clear();
+        for (const auto& positions : fs.levels()) {
+            levels.emplace_back();
+            for (size_t k : positions) levels.back().push_back(order[k]);
+        }
+    }
+
+    /**
+     * @brief Число потоков пула.
+     */
+    size_t threadCount() const { return pool.size(); }
+
+    /**
+     * @brief Пересчитывает схему уровень за уровнем.
+     */
+    void run() {
+        const TraceScope trace("ParallelExecutor::run");
+        for (size_t l = 0; l < levels.size(); l++) {
+            const TraceScope step("Level", nullptr, double(l));
+            const auto& level = levels[l];
+            const function<void(size_t, size_t)> job = [&level](size_t b, size_t e) {
+                for (size_t i = b; i < e; i++) level[i]->profiledUpdate();
+            };
+            pool.parallelFor(level.size(), grain, job);
+        }
+    }
+};
+
+
+/**
+ * @class ScenarioBatch
+ * @brief Пересчёт схемы сразу для @p Lanes сценариев («дорожек») в одном проходе.
+ *
+ * Каждый поток хранит @p Lanes расходов подряд в выровненном массиве, и каждое
+ * устройство обрабатывает все дорожки одними векторными операциями
+ * (@ref addComponents / @ref scaleComponents). Поддерживаются устройства с
+ * линейной моделью (@ref Device::linearShare): выход = доля · сумма входов.
+ */
+template <size_t Lanes = 8>
+class ScenarioBatch
+{
+private:
+    vector<double, AlignedAllocator<double, 64>> flows; ///< Расходы: поток за потоком, по @p Lanes дорожек.
+    vector<uint32_t> inPtr{0};   ///< Начала входов устройств в @ref inIdx.
+    vector<StreamId> inIdx;      ///< Номера входных потоков устройств подряд.
+    vector<uint32_t> outPtr{0};  ///< Начала выходов устройств в @ref outIdx.
+    vector<StreamId> outIdx;     ///< Номера выходных потоков устройств подряд.
+    vector<double> shares;       ///< Доля суммы входов на каждый выход устройства.
+
+public:
+    static constexpr size_t lanes = Lanes; ///< Число сценариев.
+
+    /**
+     * @brief Компилирует ациклическую схему; все дорожки получают текущие расходы потоков.
+     * @param fs Схема; номера потоков соответствуют @ref Flowsheet::loadTable.
+     * @throw std::string Если в схеме есть нелинейное устройство.
+     */
+    void build(Flowsheet& fs) {
+        const auto& order = fs.schedule();
+        inPtr.assign(1, 0); outPtr.assign(1, 0);
+        inIdx.clear(); outIdx.clear(); shares.clear();
+        for (size_t k = 0; k < order.size(); k++) {
+            const double share = order[k]->linearShare();
+            if (share < 0) throw "Device is not supported in scenario mode"s;
+            auto in = fs.inputIds(k), out = fs.outputIds(k);
+            inIdx.insert(inIdx.end(), in.begin(), in.end());
+            outIdx.insert(outIdx.end(), out.begin(), out.end());
+            inPtr.push_back(static_cast<uint32_t>(inIdx.size()));
+            outPtr.push_back(static_cast<uint32_t>(outIdx.size()));
+            shares.push_back(share);
+        }
+        const auto& streams = fs.getStreams();
+        flows.assign(streams.size() * Lanes, 0.0);
+        for (size_t s = 0; s < streams.size(); s++)
+            for (size_t l = 0; l < Lanes; l++) flows[s*Lanes + l] = streams[s]->getMassFlow();
+    }
+
+    /**
+     * @brief Дорожки потока: @p Lanes расходов подряд.
+     * @param id Номер потока.
+     */
+    double* lanesOf(StreamId id) { return flows.data() + size_t(id) * Lanes; }
+    const double* lanesOf(StreamId id) const { return flows.data() + size_t(id) * Lanes; }
+
+    /**
+     * @brief Устанавливает расход потока в одном сценарии.
+     */
+    void setMassFlow(StreamId id, size_t lane, double m) { lanesOf(id)[lane] = m; }
+
+    /**
+     * @brief Возвращает расход потока в одном сценарии.
+     */
+    double getMassFlow(StreamId id, size_t lane) const { return lanesOf(id)[lane]; }
+
+    /**
+     * @brief Пересчитывает все устройства для всех сценариев.
+     */
+    void evaluate() {
+        const size_t ops = shares.size();
+        for (size_t k = 0; k < ops; k++) {
+            const uint32_t ob = outPtr[k], oe = outPtr[k+1];
+            if (ob == oe) continue;
+            double* acc = lanesOf(outIdx[ob]);
+            const uint32_t ib = inPtr[k], ie = inPtr[k+1];
+            if (ib == ie) {
+                fill(acc, acc + Lanes, 0.0);
+            } else {
+                scaleComponents(acc, lanesOf(inIdx[ib]), 1.0, Lanes);
+                for (uint32_t i = ib + 1; i < ie; i++) addComponents(acc, lanesOf(inIdx[i]), Lanes);
+            }
+            scaleComponents(acc, acc, shares[k], Lanes);
+            for (uint32_t o = ob + 1; o < oe; o++) scaleComponents(lanesOf(outIdx[o]), acc, 1.0, Lanes);
+        }
+    }
+};
+
+
+/**
+ * @class Philox4x32
+ * @brief Счётчиковый генератор Philox4x32-10: блок из четырёх 32-битных чисел
+ *        является чистой функцией счётчика и ключа, поэтому выборку можно
+ *        вычислять в любом порядке и на любом числе потоков.
+ */
+class Philox4x32
+{
+public:
+    using Block = array<uint32_t, 4>; ///< Счётчик или результат.
+
+    /**
+     * @brief Вычисляет блок случайных чисел.
+     * @param ctr Счётчик.
+     * @param key Ключ (обычно зерно).
+     * @return Четыре равномерно распределённых 32-битных числа.
+     */
+    static Block generate(Block ctr, array<uint32_t, 2> key) {
+        for (int round = 0; round < 10; round++) {
+            const uint64_t p0 = uint64_t(0xD2511F53u) * ctr[0];
+            const uint64_t p1 = uint64_t(0xCD9E8D57u) * ctr[2];
+            ctr = {uint32_t(p1 >> 32) ^ ctr[1] ^ key[0], uint32_t(p1),
+                   uint32_t(p0 >> 32) ^ ctr[3] ^ key[1], uint32_t(p0)};
+            key[0] += 0x9E3779B9u;
+            key[1] += 0xBB67AE85u;
+        }
+        return ctr;
+    }
+
+    /**
+     * @brief Переводит два 32-битных числа в double из интервала (0, 1) с 53 значащими битами.
+     */
+    static double toUnit(uint32_t hi, uint32_t lo) {
+        const uint64_t bits = ((uint64_t(hi) << 32) | lo) >> 11;
+        return (double(bits) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+};
+
+
+/**
+ * @struct FeedDistribution
+ * @brief Распределение расхода потока-сырья для метода Монте-Карло.
+ */
+struct FeedDistribution
+{
+    /**
+     * @brief Вид распределения.
+     */
+    enum Kind
+    {
+        Uniform,   ///< Равномерное на [a, b].
+        Normal,    ///< Нормальное: среднее a, СКО b.
+        LogNormal  ///< Логнормальное: параметры a, b нормального логарифма.
+    };
+
+    Kind kind = Uniform; ///< Вид распределения.
+    double a = 0.0;      ///< Первый параметр.
+    double b = 1.0;      ///< Второй параметр.
+
+    /**
+     * @brief Преобразует две равномерные величины из (0, 1) в значение распределения.
+     */
+    double sample(double u1, double u2) const {
+        switch (kind) {
+        case Uniform:
+            return a + (b - a) * u1;
+        case Normal:
+            return a + b * sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+        case LogNormal:
+            return exp(a + b * sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2));
+        }
+        return 0.0;
+    }
+};
+
+
+/**
+ * @class RunningStats
+ * @brief Потоковые среднее, дисперсия (алгоритм Уэлфорда), минимум и максимум.
+ */
+class RunningStats
+{
+private:
+    size_t n = 0;     ///< Число наблюдений.
+    double mu = 0.0;  ///< Текущее среднее.
+    double m2 = 0.0;  ///< Сумма квадратов отклонений.
+    double lo = INFINITY, hi = -INFINITY; ///< Минимум и максимум.
+
+public:
+    /**
+     * @brief Добавляет наблюдение.
+     */
+    void add(double x) {
+        n++;
+        const double d = x - mu;
+        mu += d / n;
+        m2 += d * (x - mu);
+        lo = std::min(lo, x);
+        hi = std::max(hi, x);
+    }
+
+    size_t count() const { return n; }
+    double mean() const { return mu; }
+    /** @brief Несмещённая выборочная дисперсия. */
+    double variance() const { return n > 1 ? m2 / (n - 1) : 0.0; }
+    double minimum() const { return lo; }
+    double maximum() const { return hi; }
+};
+
+
+/**
+ * @class P2Quantile
+ * @brief Оценка квантиля алгоритмом P² (Jain, Chlamtac) за O(1) памяти без хранения выборки.
+ */
+class P2Quantile
+{
+private:
+    double p;           ///< Оцениваемый уровень квантиля.
+    size_t n = 0;       ///< Число наблюдений.
+    double q[5];        ///< Высоты маркеров.
+    double pos[5];      ///< Фактические позиции маркеров.
+    double desired[5];  ///< Желаемые позиции маркеров.
+    double inc[5];      ///< Приращения желаемых позиций.
+
+public:
+    /**
+     * @param level Уровень квантиля из (0, 1).
+     */
+    explicit P2Quantile(double level): p(level) {
+        const double d[5] = {1, 1 + 2*p, 1 + 4*p, 3 + 2*p, 5};
+        const double i[5] = {0, p/2, p, (1 + p)/2, 1};
+        for (int k = 0; k < 5; k++) { pos[k] = k + 1; desired[k] = d[k]; inc[k] = i[k]; q[k] = 0.0; }
+    }
+
+    /**
+     * @brief Уровень квантиля.
+     */
+    double level() const { return p; }
+
+    /**
+     * @brief Добавляет наблюдение.
+     */
+    void add(double x) {
+        if (n < 5) {
+            q[n++] = x;
+            if (n == 5) sort(q, q + 5);
+            return;
+        }
+        n++;
+        int k;
+        if (x < q[0]) { q[0] = x; k = 0; }
+        else if (x >= q[4]) { q[4] = x; k = 3; }
+        else { k = 0; while (x >= q[k+1]) k++; }
+        for (int i = k + 1; i < 5; i++) pos[i] += 1;
+        for (int i = 0; i < 5; i++) desired[i] += inc[i];
+
+        for (int i = 1; i <= 3; i++) {
+            const double d = desired[i] - pos[i];
+            if ((d >= 1 && pos[i+1] - pos[i] > 1) || (d <= -1 && pos[i-1] - pos[i] < -1)) {
+                const int s = d > 0 ? 1 : -1;
+                const double qp = q[i] + s / (pos[i+1] - pos[i-1]) *
+                    ((pos[i] - pos[i-1] + s) * (q[i+1] - q[i]) / (pos[i+1] - pos[i]) +
+                     (pos[i+1] - pos[i] - s) * (q[i] - q[i-1]) / (pos[i] - pos[i-1]));
+                if (q[i-1] < qp && qp < q[i+1]) q[i] = qp;
+                else q[i] += s * (q[i+s] - q[i]) / (pos[i+s] - pos[i]);
+                pos[i] += s;
+            }
+        }
+    }
+
+    /**
+     * @brief Текущая оценка квантиля.
+     */
+    double value() const {
+        if (n >= 5) return q[2];
+        if (n == 0) return 0.0;
+        double tmp[5];
+        copy(q, q + n, tmp);
+        sort(tmp, tmp + n);
+        return tmp[min(n - 1, size_t(p * n))];
+    }
+};
+
+
+/**
+ * @struct MonteCarloOptions
+ * @brief Настройки @ref MonteCarlo::run.
+ */
+struct MonteCarloOptions
+{
+    size_t samples = 10000;   ///< Число реализаций.
+    uint64_t seed = 1;        ///< Зерно генератора.
+    size_t threads = 0;       ///< Число потоков; 0 — по числу ядер. На результат не влияет.
+    vector<double> quantiles = {0.05, 0.5, 0.95}; ///< Оцениваемые квантили.
+};
+
+/**
+ * @struct OutputSummary
+ * @brief Сводная статистика одного наблюдаемого потока.
+ */
+struct OutputSummary
+{
+    RunningStats stats;            ///< Среднее, дисперсия, экстремумы.
+    vector<P2Quantile> quantiles;  ///< Оценки квантилей в порядке @ref MonteCarloOptions::quantiles.
+};
+
+
+/**
+ * @class MonteCarlo
+ * @brief Распространение неопределённости расходов сырья через схему методом Монте-Карло.
+ *
+ * Реализация с номером i получает значения сырья из блока Philox со счётчиком
+ * (i, номер сырья), поэтому выборка не зависит от порядка вычислений. Реализации
+ * считаются пачками по @ref ScenarioBatch::lanes на пуле потоков; результаты
+ * раунда сводятся в статистику строго по возрастанию номера реализации, так что
+ * итог побитово одинаков при любом числе потоков. Отдельные реализации не хранятся.
+ */
+class MonteCarlo
+{
+private:
+    using Batch = ScenarioBatch<8>;
+    static constexpr size_t roundBatches = 256; ///< Пачек в раунде между сведениями статистики.
+
+    Flowsheet& fs;                                  ///< Схема.
+    vector<pair<StreamId, FeedDistribution>> feeds; ///< Случайные потоки-сырьё.
+    vector<StreamId> watched;                       ///< Наблюдаемые потоки.
+
+public:
+    /**
+     * @param flowsheet Ациклическая схема из линейных устройств.
+     */
+    explicit MonteCarlo(Flowsheet& flowsheet): fs(flowsheet) {}
+
+    /**
+     * @brief Делает поток случайным.
+     * @param id Номер потока.
+     * @param dist Распределение его расхода.
+     */
+    void addFeed(StreamId id, const FeedDistribution& dist) { feeds.push_back({id, dist}); }
+
+    /**
+     * @brief Добавляет поток в число наблюдаемых.
+     * @param id Номер потока.
+     */
+    void watch(StreamId id) { watched.push_back(id); }
+
+    /**
+     * @brief Значение сырья @p feed в реализации @p sample.
+     */
+    double sampleFeed(uint64_t seed, size_t sample, size_t feed) const {
+        const auto r = Philox4x32::generate({uint32_t(sample), uint32_t(uint64_t(sample) >> 32), uint32_t(feed), 0},
+                                            {uint32_t(seed), uint32_t(seed >> 32)});
+        return feeds[feed].second.sample(Philox4x32::toUnit(r[0], r[1]), Philox4x32::toUnit(r[2], r[3]));
+    }
+
+    /**
+     * @brief Выполняет расчёт.
+     * @param opt Число реализаций, зерно, потоки и квантили.
+     * @return Статистика по каждому наблюдаемому потоку в порядке @ref watch.
+     */
+    vector<OutputSummary> run(const MonteCarloOptions& opt) {
+        const size_t L = Batch::lanes;
+        WorkStealingPool pool(opt.threads);
+        vector<Batch> scratch(pool.size());
+        for (auto& b : scratch) b.build(fs);
+
+        vector<OutputSummary> summary(watched.size());
+        for (auto& s : summary)
+            for (double q : opt.quantiles) s.quantiles.emplace_back(q);
+
+        const size_t batches = (opt.samples + L - 1) / L;
+        vector<double> results(roundBatches * watched.size() * L);
+        for (size_t first = 0; first < batches; first += roundBatches) {
+            const size_t count = min(roundBatches, batches - first);
+            pool.parallelFor(count, 4, [&](size_t b, size_t e, size_t worker) {
+                Batch& batch = scratch[worker];
+                for (size_t j = b; j < e; j++) {
+                    const size_t base = (first + j) * L;
+                    for (size_t f = 0; f < feeds.size(); f++) {
+                        double* lanes = batch.lanesOf(feeds[f].first);
+                        for (size_t l = 0; l < L; l++) lanes[l] = sampleFeed(opt.seed, base + l, f);
+                    }
+                    batch.evaluate();
+                    for (size_t w = 0; w < watched.size(); w++) {
+                        const double* lanes = batch.lanesOf(watched[w]);
+                        copy(lanes, lanes + L, results.begin() + (j * watched.size() + w) * L);
+                    }
+                }
+            });
+
+            for (size_t j = 0; j < count; j++) {
+                const size_t base = (first + j) * L;
+                const size_t valid = min(L, opt.samples - base);
+                for (size_t w = 0; w < watched.size(); w++) {
+                    for (size_t l = 0; l < valid; l++) {
+                        const double x = results[(j * watched.size() + w) * L + l];
+                        summary[w].stats.add(x);
+                        for (auto& q : summary[w].quantiles) q.add(x);
+                    }
+                }
+            }
+        }
+        return summary;
+    }
+};
+
+
+/**
+ * @class SparseLU
+ * @brief Разреженное LU-разложение без выбора ведущего элемента со строчным хранением.
+ *
+ * Символьный этап (@ref analyze) один раз вычисляет портрет множителей L и U с
+ * учётом заполнения, численный (@ref factorize) — значения для заданной матрицы
+ * того же портрета, а @ref solve многократно решает систему с разными правыми
+ * частями. Разложение без перестановок устойчиво для M-матриц, которыми являются
+ * системы материального баланса схем со стоком.
+ */
+class SparseLU
+{
+private:
+    size_t n = 0;                 ///< Размер системы.
+    vector<size_t> aPtr;          ///< Строки исходной матрицы (CSR).
+    vector<uint32_t> aCol;
+    vector<size_t> lPtr, uPtr;    ///< Строки множителей L (без диагонали) и U (с диагональю первой).
+    vector<uint32_t> lCol, uCol;
+    vector<double> lVal, uVal;
+    vector<double> work;          ///< Плотная рабочая строка численного этапа.
+
+public:
+    /**
+     * @brief Символьный этап: портрет L и U по портрету матрицы.
+     * @param size Размер системы.
+     * @param ptr Начала строк в @p col (size + 1 элементов).
+     * @param col Номера столбцов ненулевых элементов; каждая строка должна содержать диагональ.
+     */
+    void analyze(size_t size, const vector<size_t>& ptr, const vector<uint32_t>& col) {
+        n = size; aPtr = ptr; aCol = col;
+        lPtr.assign(1, 0); uPtr.assign(1, 0);
+        lCol.clear(); uCol.clear();
+        vector<char> mark(n, 0);
+        vector<uint32_t> row;
+        vector<uint32_t> pending; // min-куча столбцов левее диагонали
+
+        for (size_t i = 0; i < n; i++) {
+            row.clear();
+            for (size_t p = aPtr[i]; p < aPtr[i+1]; p++) {
+                uint32_t c = aCol[p];
+                if (mark[c]) continue;
+                mark[c] = 1; row.push_back(c);
+                if (c < i) { pending.push_back(c); push_heap(pending.begin(), pending.end(), greater<uint32_t>()); }
+            }
+            while (!pending.empty()) {
+                pop_heap(pending.begin(), pending.end(), greater<uint32_t>());
+                uint32_t k = pending.back(); pending.pop_back();
+                for (size_t p = uPtr[k] + 1; p < uPtr[k+1]; p++) {
+                    uint32_t c = uCol[p];
+                    if (mark[c]) continue;
+                    mark[c] = 1; row.push_back(c);
+                    if (c < i) { pending.push_back(c); push_heap(pending.begin(), pending.end(), greater<uint32_t>()); }
+                }
+            }
+            sort(row.begin(), row.end());
+            if (!mark[i]) throw "Linear system has an empty diagonal"s;
+            for (uint32_t c : row) {
+                mark[c] = 0;
+                if (c < i) lCol.push_back(c);
+            }
+            uCol.push_back(static_cast<uint32_t>(i));
+            for (uint32_t c : row) if (c > i) uCol.push_back(c);
+            lPtr.push_back(lCol.size());
+            uPtr.push_back(uCol.size());
+        }
+        lVal.assign(lCol.size(), 0.0);
+        uVal.assign(uCol.size(), 0.0);
+        work.assign(n, 0.0);
+    }
+
+    /**
+     * @brief Численный этап для матрицы с портретом, переданным в @ref analyze.
+     * @param val Значения ненулевых элементов в порядке @c col из @ref analyze.
+     * @throw std::string Если встретился нулевой ведущий элемент.
+     */
+    void factorize(const vector<double>& val) {
+        for (size_t i = 0; i < n; i++) {
+            for (size_t p = aPtr[i]; p < aPtr[i+1]; p++) work[aCol[p]] += val[p];
+            for (size_t p = lPtr[i]; p < lPtr[i+1]; p++) {
+                uint32_t k = lCol[p];
+                double l = work[k] / uVal[uPtr[k]];
+                work[k] = 0.0;
+                lVal[p] = l;
+                for (size_t q = uPtr[k] + 1; q < uPtr[k+1]; q++) work[uCol[q]] -= l * uVal[q];
+            }
+            for (size_t p = uPtr[i]; p < uPtr[i+1]; p++) {
+                uVal[p] = work[uCol[p]];
+                work[uCol[p]] = 0.0;
+            }
+            if (fabs(uVal[uPtr[i]]) < 1e-14) throw "Linear system is singular"s;
+        }
+    }
+
+    /**
+     * @brief Решает L·U·x = b на месте.
+     * @param b Правая часть; заменяется решением.
+     */
+    void solve(double* b) const {
+        for (size_t i = 0; i < n; i++)
+            for (size_t p = lPtr[i]; p < lPtr[i+1]; p++) b[i] -= lVal[p] * b[lCol[p]];
+        for (size_t i = n; i-- > 0;) {
+            for (size_t p = uPtr[i] + 1; p < uPtr[i+1]; p++) b[i] -= uVal[p] * b[uCol[p]];
+            b[i] /= uVal[uPtr[i]];
+        }
+    }
+
+    /**
+     * @brief Число ненулевых элементов L и U вместе (мера заполнения).
+     */
+    size_t nonZeros() const { return lCol.size() + uCol.size(); }
+};
+
+
+/**
+ * @class LinearFlowsheetSolver
+ * @brief Уравнительно-ориентированный режим: вся схема решается как одна разреженная линейная система.
+ *
+ * Неизвестные — расходы всех потоков. Для потока-сырья уравнение x = расход
+ * сырья; для выхода устройства — x_out − share·Σ x_in = 0, где share берётся из
+ * @ref Device::linearShare. Матрица зависит только от топологии, поэтому
+ * разложение выполняется один раз в @ref analyze, а @ref solve лишь подставляет
+ * текущие расходы сырья и выполняет прямой и обратный ход.
+ */
+class LinearFlowsheetSolver
+{
+private:
+    vector<Stream*> unknowns;  ///< Потоки в порядке неизвестных системы.
+    vector<char> isFeed;       ///< Является ли неизвестная потоком-сырьём.
+    vector<double> rhs;        ///< Правая часть / решение.
+    SparseLU lu;               ///< Разложение матрицы баланса.
+    int factorizations = 0;    ///< Сколько раз выполнялось разложение.
+
+public:
+    /**
+     * @brief Собирает систему по схеме и раскладывает её.
+     *
+     * Неизвестные упорядочены так же, как @ref Flowsheet::evaluationOrder: сырьё,
+     * затем выходы устройств; ациклическая часть схемы даёт треугольную матрицу
+     * без заполнения, заполнение возникает только на рециклах.
+     * @param fs Схема из линейных устройств.
+     * @throw std::string Если устройство нелинейно, у него неполные порты, у потока
+     *        несколько производителей или система вырождена.
+     */
+    void analyze(Flowsheet& fs) {
+        const auto order = fs.evaluationOrder();
+        unordered_map<const Stream*, uint32_t> index;
+        unknowns.clear(); isFeed.clear();
+        unordered_set<const Stream*> produced;
+        for (Device* d : order)
+            for (const auto& s : d->outputsView()) produced.insert(s);
+        for (const auto& s : fs.getStreams()) {
+            if (produced.count(s.get())) continue;
+            index.emplace(s.get(), static_cast<uint32_t>(unknowns.size()));
+            unknowns.push_back(s.get()); isFeed.push_back(1);
+        }
+        for (Device* d : order) {
+            // Проверки портов — как в FlowsheetPlan::compile: доля linearShare
+            // верна только при всех заявленных выходах.
+            const size_t nIn = d->inputsView().size(), nOut = d->outputsView().size();
+            const string name = string("Device (") + d->typeName() + ")";
+            if (nIn == 0 || nIn > static_cast<size_t>(d->inputLimit())) {
+                throw name + ": expected 1 to " + to_string(d->inputLimit()) + " inputs, connected " + to_string(nIn);
+            }
+            if (nOut != static_cast<size_t>(d->outputLimit())) {
+                throw name + ": expected " + to_string(d->outputLimit()) + " outputs, connected " + to_string(nOut);
+            }
+            for (const auto& s : d->outputsView()) {
+                if (!index.emplace(s, static_cast<uint32_t>(unknowns.size())).second) {
+                    throw "Stream " + s->getName() + " has several producers";
+                }
+                unknowns.push_back(s); isFeed.push_back(0);
+            }
+        }
+
+        const size_t n = unknowns.size();
+        vector<size_t> ptr(n + 1, 0);
+        vector<uint32_t> col;
+        vector<double> val;
+        size_t row = 0;
+        for (; row < n && isFeed[row]; row++) {
+            col.push_back(static_cast<uint32_t>(row)); val.push_back(1.0);
+            ptr[row+1] = col.size();
+        }
+        for (Device* d : order) {
+            const double share = d->linearShare();
+            if (share < 0) throw "Device is not linear"s;
+            const auto ins = d->inputsView();
+            for (size_t o = 0; o < d->outputsView().size(); o++, row++) {
+                size_t begin = col.size();
+                col.push_back(static_cast<uint32_t>(row)); val.push_back(1.0);
+                for (const auto& s : ins) {
+                    uint32_t c = index.at(s);
+                    size_t p = begin;
+                    while (p < col.size() && col[p] != c) p++;
+                    if (p == col.size()) { col.push_back(c); val.push_back(0.0); }
+                    val[p] -= share;
+                }
+                ptr[row+1] = col.size();
+            }
+        }
+
+        lu.analyze(n, ptr, col);
+        lu.factorize(val);
+        factorizations++;
+        rhs.assign(n, 0.0);
+    }
+
+    /**
+     * @brief Решает систему для текущих расходов сырья и записывает расходы во все потоки.
+     */
+    void solve() {
+        const TraceScope trace("LinearFlowsheetSolver::solve");
+        for (size_t i = 0; i < unknowns.size(); i++)
+            rhs[i] = isFeed[i] ? unknowns[i]->getMassFlow() : 0.0;
+        lu.solve(rhs.data());
+        for (size_t i = 0; i < unknowns.size(); i++)
+            if (!isFeed[i]) unknowns[i]->setMassFlow(rhs[i]);
+    }
+
+    /**
+     * @brief Сколько раз выполнялось разложение (для контроля повторного использования).
+     */
+    int factorizationCount() const { return factorizations; }
+
+    /**
+     * @brief Разложение матрицы баланса.
+     */
+    const SparseLU& factorization() const { return lu; }
+};
+
+
+/**
+ * @brief Метод интегрирования @ref DynamicSimulator.
+ */
+enum class Integrator
+{
+    Euler,       ///< Явный метод Эйлера с постоянным шагом.
+    RungeKutta4, ///< Классический метод Рунге — Кутты 4-го порядка с постоянным шагом.
+    Adaptive23   ///< Вложенная пара Богацкого — Шампина 3(2) с выбором шага по точности.
+};
+
+/**
+ * @struct DynamicOptions
+ * @brief Настройки динамического расчёта.
+ */
+struct DynamicOptions
+{
+    Integrator method = Integrator::RungeKutta4; ///< Метод интегрирования.
+    double step = 1.0;          ///< Шаг постоянных методов и начальный шаг адаптивного.
+    double relTolerance = 1e-6; ///< Относительная точность адаптивного метода.
+    double absTolerance = 1e-9; ///< Абсолютная точность адаптивного метода.
+    double minStep = 1e-6;      ///< Наименьший шаг адаптивного метода; такой шаг принимается всегда.
+    double maxStep = 3600.0;    ///< Наибольший шаг адаптивного метода.
+};
+
+/**
+ * @struct DynamicReport
+ * @brief Итог динамического расчёта с момента создания @ref DynamicSimulator.
+ */
+struct DynamicReport
+{
+    double time = 0.0;    ///< Текущее модельное время.
+    long steps = 0;       ///< Принятые шаги.
+    long rejected = 0;    ///< Отклонённые шаги адаптивного метода.
+    long evaluations = 0; ///< Пересчёты схемы (вычисления правой части).
+};
+
+
+/**
+ * @class DynamicSimulator
+ * @brief Интегрирует запасы устройств схемы (@ref Device::stateSize) по времени.
+ *
+ * Выходы устройств с запасом зависят только от запаса, поэтому в графе они
+ * считаются источниками: рецикл через ёмкость допустим, а пересчёт схемы при
+ * заданных запасах — один проход в топологическом порядке. Каждое вычисление
+ * правой части загружает запасы в устройства, пересчитывает схему и собирает
+ * производные. Все рабочие массивы выделяются в конструкторе, поэтому
+ * @ref advance не выделяет память.
+ */
+class DynamicSimulator
+{
+private:
+    vector<Device*> order;   ///< Устройства в порядке пересчёта при заданных запасах.
+    vector<Device*> holders; ///< Устройства с запасом.
+    vector<size_t> offsets;  ///< Переменные k-го устройства с запасом — [offsets[k], offsets[k+1]).
+    vector<double> x, x1, k1, k2, k3, k4; ///< Состояние, пробное состояние и стадии метода.
+    DynamicOptions opt;      ///< Настройки.
+    DynamicReport rep;       ///< Итог расчёта.
+    double h;                ///< Текущий шаг адаптивного метода.
+    bool rateReady = false;  ///< Соответствует ли @ref k1 текущему состоянию (FSAL адаптивного метода).
+
+    /**
+     * @brief Вычисляет производные состояния @p state в момент @p t; потоки схемы
+     *        остаются пересчитанными для этого состояния.
+     */
+    template <class F>
+    void evaluate(double t, const double* state, double* rate, F& boundary) {
+        boundary(t);
+        for (size_t k = 0; k < holders.size(); k++) holders[k]->loadState(state + offsets[k]);
+        for (Device* d : order) d->profiledUpdate();
+        for (size_t k = 0; k < holders.size(); k++) holders[k]->stateRate(rate + offsets[k]);
+        rep.evaluations++;
+    }
+
+    /**
+     * @brief Один шаг постоянного метода до момента @p next.
+     */
+    template <class F>
+    void fixedStep(double next, F& boundary) {
+        const double t = rep.time, dt = next - t;
+        const size_t n = x.size();
+        evaluate(t, x.data(), k1.data(), boundary);
+        if (opt.method == Integrator::Euler) {
+            for (size_t i = 0; i < n; i++) x[i] += dt * k1[i];
+        } else {
+            for (size_t i = 0; i < n; i++) x1[i] = x[i] + 0.5*dt * k1[i];
+            evaluate(t + 0.5*dt, x1.data(), k2.data(), boundary);
+            for (size_t i = 0; i < n; i++) x1[i] = x[i] + 0.5*dt * k2[i];
+            evaluate(t + 0.5*dt, x1.data(), k3.data(), boundary);
+            for (size_t i = 0; i < n; i++) x1[i] = x[i] + dt * k3[i];
+            evaluate(t + dt, x1.data(), k4.data(), boundary);
+            for (size_t i = 0; i < n; i++) x[i] += dt/6.0 * (k1[i] + 2.0*k2[i] + 2.0*k3[i] + k4[i]);
+        }
+        rep.time = next;
+        rep.steps++;
+    }
+
+    /**
+     * @brief Одна попытка шага адаптивного метода длиной @p dt.
+     * @return Принят ли шаг; @p dt заменяется рекомендуемым следующим шагом.
+     */
+    template <class F>
+    bool adaptiveStep(double& dt, F& boundary) {
+        const double t = rep.time;
+        const size_t n = x.size();
+        if (!rateReady) evaluate(t, x.data(), k1.data(), boundary);
+        rateReady = true;
+
+        for (size_t i = 0; i < n; i++) x1[i] = x[i] + 0.5*dt * k1[i];
+        evaluate(t + 0.5*dt, x1.data(), k2.data(), boundary);
+        for (size_t i = 0; i < n; i++) x1[i] = x[i] + 0.75*dt * k2[i];
+        evaluate(t + 0.75*dt, x1.data(), k3.data(), boundary);
+        for (size_t i = 0; i < n; i++) x1[i] = x[i] + dt * (2.0/9.0*k1[i] + 1.0/3.0*k2[i] + 4.0/9.0*k3[i]);
+        evaluate(t + dt, x1.data(), k4.data(), boundary);
+
+        double err = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            const double e = dt * (-5.0/72.0*k1[i] + 1.0/12.0*k2[i] + 1.0/9.0*k3[i] - 1.0/8.0*k4[i]);
+            const double scale = opt.absTolerance + opt.relTolerance * max(fabs(x[i]), fabs(x1[i]));
+            err = max(err, fabs(e) / scale);
+        }
+
+        const bool accepted = err <= 1.0 || dt <= opt.minStep;
+        if (accepted) {
+            x.swap(x1);
+            k1.swap(k4);
+            rep.time += dt;
+            rep.steps++;
+        } else {
+            rep.rejected++;
+        }
+        const double factor = err == 0.0 ? 5.0 : min(5.0, max(0.2, 0.9 * pow(err, -1.0/3.0)));
+        dt = min(max(dt * factor, opt.minStep), opt.maxStep);
+        return accepted;
+    }
+
+public:
+    /**
+     * @brief Строит порядок пересчёта и выделяет рабочие массивы.
+     *
+     * Начальное состояние — текущие запасы устройств.
+     * @param fs Схема; устройства должны жить, пока используется расчёт.
+     * @param options Метод и шаг интегрирования.
+     * @throw std::string Если настройки некорректны, у потока несколько
+     *        производителей или есть рецикл без устройства с запасом.
+     */
+    DynamicSimulator(const Flowsheet& fs, const DynamicOptions& options = DynamicOptions()): opt(options), h(options.step) {
+        if (!(opt.step > 0.0) || !(opt.minStep > 0.0) || opt.maxStep < opt.minStep) {
+            throw "Invalid integration step"s;
+        }
+        const auto& devices = fs.getDevices();
+        const size_t n = devices.size();
+        unordered_map<const Stream*, size_t> producer;
+        for (size_t d = 0; d < n; d++) {
+            for (const auto& s : devices[d]->outputsView()) {
+                if (!producer.emplace(s, d).second) {
+                    throw "Stream " + s->getName() + " has several producers";
+                }
+            }
+        }
+
+        // Алгоритм Кана; выходы устройства с запасом не зависят от его входов,
+        // поэтому дуги в такие устройства не учитываются, а дуги из них — учитываются.
+        vector<size_t> pending(n, 0), ready;
+        vector<vector<size_t>> consumers(n);
+        for (size_t d = 0; d < n; d++) {
+            if (devices[d]->stateSize() != 0) continue;
+            for (const auto& s : devices[d]->inputsView()) {
+                auto p = producer.find(s);
+                if (p == producer.end()) continue;
+                consumers[p->second].push_back(d);
+                pending[d]++;
+            }
+        }
+        for (size_t d = 0; d < n; d++)
+            if (pending[d] == 0) ready.push_back(d);
+        for (size_t i = 0; i < ready.size(); i++)
+            for (size_t c : consumers[ready[i]])
+                if (--pending[c] == 0) ready.push_back(c);
+        if (ready.size() != n) {
+            throw "Flowsheet contains a recycle loop without holdup"s;
+        }
+
+        offsets.assign(1, 0);
+        for (size_t d : ready) {
+            Device* dev = devices[d].get();
+            order.push_back(dev);
+            if (dev->stateSize() == 0) continue;
+            holders.push_back(dev);
+            offsets.push_back(offsets.back() + dev->stateSize());
+        }
+        const size_t m = offsets.back();
+        x.assign(m, 0.0);
+        for (vector<double>* v : {&x1, &k1, &k2, &k3, &k4}) v->assign(m, 0.0);
+        for (size_t k = 0; k < holders.size(); k++) holders[k]->saveState(x.data() + offsets[k]);
+    }
+
+    /**
+     * @brief Продвигает расчёт на @p duration единиц времени.
+     *
+     * Перед каждым пересчётом схемы вызывается @p boundary(t) с модельным
+     * временем, так что сырьё может зависеть от времени. По окончании запасы
+     * устройств и расходы всех потоков соответствуют конечному моменту.
+     * @param duration Длительность, неотрицательная.
+     * @param boundary Граничные условия: @c void(double t); не должна менять запасы.
+     */
+    template <class F>
+    void advance(double duration, F&& boundary) {
+        const TraceScope trace("DynamicSimulator::advance");
+        const double end = rep.time + duration;
+        const double eps = 1e-12 * max(1.0, fabs(end));
+        rateReady = false; // граничные условия могли измениться между вызовами
+        if (opt.method == Integrator::Adaptive23) {
+            while (end - rep.time > eps) {
+                const bool last = h >= end - rep.time;
+                double dt = last ? end - rep.time : h;
+                if (adaptiveStep(dt, boundary) && last) rep.time = end;
+                if (!last || dt < h) h = dt;
+            }
+            return;
+        }
+        const double start = rep.time;
+        for (long i = 1; end - rep.time > eps; i++) {
+            const double next = start + i * opt.step; // без накопления ошибки округления
+            fixedStep(end - next > eps ? next : end, boundary);
+        }
+        evaluate(rep.time, x.data(), k1.data(), boundary);
+    }
+
+    /**
+     * @brief @ref advance без граничных условий: сырьё остаётся постоянным.
+     */
+    void advance(double duration) { advance(duration, [](double) {}); }
+
+    /**
+     * @brief Текущее модельное время.
+     */
+    double time() const { return rep.time; }
+
+    /**
+     * @brief Итог расчёта.
+     */
+    const DynamicReport& report() const { return rep; }
+
+    /**
+     * @brief Число переменных состояния схемы.
+     */
+    size_t stateCount() const { return x.size(); }
+
+    /**
+     * @brief Текущий шаг адаптивного метода.
+     */
+    double currentStep() const { return h; }
+};
+
+
+/**
+ * @struct GeneratorOptions
+ * @brief Параметры синтетической схемы @ref FlowsheetGenerator.
+ */
+struct GeneratorOptions
+{
+    size_t devices = 1000;       ///< Число устройств.
+    size_t depth = 10;           ///< Число уровней — длина самого длинного прямого пути в устройствах.
+    int maxFanIn = 4;            ///< Наибольшее число прямых входов миксера.
+    double reactorShare = 0.3;   ///< Доля реакторов среди устройств; половина из них с двумя выходами.
+    double recycleDensity = 0.0; ///< Вероятность того, что второй выход реактора возвращается в миксер выше по схеме.
+    double minFeed = 1.0;        ///< Нижняя граница начального расхода сырья.
+    double maxFeed = 10.0;       ///< Верхняя граница начального расхода сырья.
+    uint64_t seed = 1;           ///< Зерно генератора.
+};
+
+/**
+ * @struct GeneratedFlowsheet
+ * @brief Сведения о схеме, построенной @ref FlowsheetGenerator.
+ */
+struct GeneratedFlowsheet
+{
+    vector<StreamId> feeds;    ///< Потоки-сырьё.
+    vector<StreamId> products; ///< Потоки, которые не читает ни одно устройство.
+    vector<StreamId> recycles; ///< Потоки, возвращаемые на тот же или более ранний уровень.
+};
+
+
+/**
+ * @class FlowsheetGenerator
+ * @brief Строит случайную, но корректную схему из миксеров и реакторов заданного размера.
+ *
+ * Устройства равномерно распределяются по уровням. Первый вход устройства берётся
+ * из выходов предыдущего уровня, остальные входы миксера — из любых ещё не
+ * прочитанных потоков; сырьё создаётся, только когда таких потоков не осталось.
+ * Второй выход двухвыходного реактора с вероятностью @ref GeneratorOptions::recycleDensity
+ * становится рециклом в случайный миксер на пути первых входов выше реактора, так
+ * что образуется замкнутый контур. Первый выход всегда идёт вперёд, поэтому из
+ * любого рецикла есть сток и простая итерация сходится.
+ * Случайные числа берутся из @ref Philox4x32 по зерну, так что схема полностью
+ * определяется параметрами.
+ */
+class FlowsheetGenerator
+{
+private:
+    GeneratorOptions opt;        ///< Параметры.
+    Philox4x32::Block block{};   ///< Текущий блок случайных чисел.
+    uint64_t counter = 0;        ///< Счётчик следующего блока.
+    size_t used = 4;             ///< Сколько чисел текущего блока уже выдано.
+
+    /**
+     * @brief Следующее 32-битное случайное число.
+     */
+    uint32_t next() {
+        if (used == 4) {
+            block = Philox4x32::generate({uint32_t(counter), uint32_t(counter >> 32), 0, 0},
+                                         {uint32_t(opt.seed), uint32_t(opt.seed >> 32)});
+            counter++;
+            used = 0;
+        }
+        return block[used++];
+    }
+
+    /**
+     * @brief Случайное целое из [0, n).
+     */
+    size_t below(size_t n) { return size_t((uint64_t(next()) * n) >> 32); }
+
+    /**
+     * @brief Случайное число из (0, 1).
+     */
+    double unit() { return Philox4x32::toUnit(next(), next()); }
+
+    /**
+     * @brief Извлекает i-й элемент из пула потоков, не сохраняя порядок.
+     */
+    static StreamId take(vector<StreamId>& pool, size_t i) {
+        StreamId s = pool[i];
+        pool[i] = pool.back();
+        pool.pop_back();
+        return s;
+    }
+
+public:
+    /**
+     * @param options Параметры схемы.
+     * @throw std::string Если глубина равна нулю или миксеру не разрешён ни один вход.
+     */
+    explicit FlowsheetGenerator(const GeneratorOptions& options): opt(options) {
+        if (opt.depth == 0 || opt.maxFanIn < 1) {
+            throw "Generator needs depth >= 1 and maxFanIn >= 1"s;
+        }
+    }
+
+    /**
+     * @brief Добавляет в схему новые потоки и устройства.
+     * @param fs Схема; уже имеющиеся в ней устройства и потоки не затрагиваются.
+     * @return Номера сырья, продуктов и рециклов.
+     */
+    GeneratedFlowsheet generate(Flowsheet& fs) {
+        counter = 0;
+        used = 4;
+        GeneratedFlowsheet info;
+        const size_t n = opt.devices, levels = min(opt.depth, max<size_t>(n, 1));
+        const StreamId none = UINT32_MAX;
+        const StreamId base = static_cast<StreamId>(fs.getStreams().size());
+
+        // Описание устройств: прямые входы в формате CSR, выходы, рециклы отдельно.
+        vector<char> isReactor(n, 0);
+        vector<uint32_t> inPtr(n + 1, 0), extra(n, 0);
+        vector<uint32_t> parent(n, none), producer; // производитель первого входа; производитель потока base + i
+        vector<uint32_t> upstream;                  // миксеры на пути первых входов
+        vector<StreamId> inIdx, out0(n), out1(n, none);
+        vector<pair<uint32_t, StreamId>> back; // (миксер, поток рецикла)
+        inIdx.reserve(n * 2);
+        fs.reserve(fs.getStreams().size() + n * 2, fs.getDevices().size() + n);
+
+        vector<StreamId> open, recent, produced; // старые непрочитанные, выходы предыдущего уровня, текущего
+        size_t d = 0;
+        for (size_t l = 0; l < levels; l++) {
+            for (const size_t end = (l + 1) * n / levels; d < end; d++) {
+                isReactor[d] = unit() < opt.reactorShare;
+                const size_t fanIn = isReactor[d] ? 1 : 1 + below(static_cast<size_t>(opt.maxFanIn));
+                for (size_t i = 0; i < fanIn; i++) {
+                    const size_t avail = open.size() + recent.size();
+                    if (i == 0 && !recent.empty()) {
+                        inIdx.push_back(take(recent, below(recent.size())));
+                    } else if (avail > 0) {
+                        const size_t r = below(avail);
+                        inIdx.push_back(r < open.size() ? take(open, r) : take(recent, r - open.size()));
+                    } else {
+                        inIdx.push_back(fs.newStream(opt.minFeed + (opt.maxFeed - opt.minFeed) * unit()));
+                        producer.push_back(none);
+                        info.feeds.push_back(inIdx.back());
+                    }
+                }
+                parent[d] = producer[inIdx[inPtr[d]] - base];
+                inPtr[d+1] = static_cast<uint32_t>(inIdx.size());
+
+                out0[d] = fs.newStream();
+                producer.push_back(static_cast<uint32_t>(d));
+                produced.push_back(out0[d]);
+                if (isReactor[d] && unit() < 0.5) {
+                    out1[d] = fs.newStream();
+                    producer.push_back(static_cast<uint32_t>(d));
+                    upstream.clear();
+                    if (unit() < opt.recycleDensity) {
+                        for (uint32_t a = parent[d]; a != none; a = parent[a])
+                            if (!isReactor[a]) upstream.push_back(a);
+                    }
+                    if (!upstream.empty()) {
+                        const uint32_t m = upstream[below(upstream.size())];
+                        back.push_back({m, out1[d]});
+                        extra[m]++;
+                        info.recycles.push_back(out1[d]);
+                    } else {
+                        produced.push_back(out1[d]);
+                    }
+                }
+            }
+            open.insert(open.end(), recent.begin(), recent.end());
+            recent.swap(produced);
+            produced.clear();
+        }
+        open.insert(open.end(), recent.begin(), recent.end());
+        info.products = move(open);
+
+        vector<Device*> made(n);
+        for (d = 0; d < n; d++) {
+            if (isReactor[d]) {
+                made[d] = &fs.newReactor(out1[d] != none);
+            } else {
+                made[d] = &fs.newMixer(static_cast<int>(inPtr[d+1] - inPtr[d] + extra[d]));
+            }
+            for (uint32_t i = inPtr[d]; i < inPtr[d+1]; i++) fs.connectInput(*made[d], inIdx[i]);
+            fs.connectOutput(*made[d], out0[d]);
+            if (out1[d] != none) fs.connectOutput(*made[d], out1[d]);
+        }
+        for (const auto& [m, s] : back) fs.connectInput(*made[m], s);
+        return info;
+    }
+};
+
+
+/**
+ * @brief Вид ошибки проверки схемы в @ref FlowsheetPlan::compile.
+ */
+enum class PlanErrorKind
+{
+    InputCount,        ///< Входов нет или подключено больше заявленного.
+    OutputCount,       ///< Число подключённых выходов не равно заявленному.
+    SeveralProducers,  ///< Поток является выходом нескольких устройств.
+    RecycleLoop,       ///< Устройство входит в рецикл или стоит ниже него по потоку.
+    UnsupportedDevice  ///< Вид устройства не поддерживается планом.
+};
+
+/**
+ * @struct PlanError
+ * @brief Одна ошибка проверки схемы.
+ */
+struct PlanError
+{
+    PlanErrorKind kind;        ///< Вид ошибки.
+    size_t device = SIZE_MAX;  ///< Индекс устройства в порядке добавления либо SIZE_MAX.
+    StreamId stream = UINT32_MAX; ///< Номер потока либо UINT32_MAX.
+    string message;            ///< Описание для человека.
+};
+
+
+/**
+ * @class FlowsheetPlan
+ * @brief Проверенный заранее план пересчёта ациклической схемы из миксеров и реакторов.
+ *
+ * @ref compile один раз проверяет числа портов, единственность производителя
+ * каждого потока, отсутствие рециклов и виды устройств, собирая все найденные
+ * ошибки, и раскладывает устройства в топологическом порядке в плоский массив
+ * шагов «сумма входов × доля → каждый выход» над плотным массивом расходов.
+ * Поэтому @ref execute не проверяет границы, не вызывает виртуальных функций и
+ * не бросает исключений; результат побитово совпадает с @ref Flowsheet::run.
+ * План считает только суммарные расходы; составы потоков меняются только
+ * масштабированием в @ref store.
+ */
+class FlowsheetPlan
+{
+private:
+    /**
+     * @struct Step
+     * @brief Шаг плана: входы — ports[inBegin, inEnd), выходы — ports[inEnd, outEnd).
+     */
+    struct Step
+    {
+        uint32_t inBegin; ///< Начало входов.
+        uint32_t inEnd;   ///< Конец входов и начало выходов.
+        uint32_t outEnd;  ///< Конец выходов.
+        double share;     ///< Доля суммы входов на каждый выход.
+    };
+
+    vector<Step> steps;        ///< Шаги в топологическом порядке.
+    vector<StreamId> ports;    ///< Номера потоков портов шагов.
+    vector<double> flows;      ///< Расходы по номерам потоков.
+    vector<Stream*> streams;   ///< Потоки схемы по номерам (для @ref load / @ref store).
+    vector<uint32_t> deviceOrder; ///< Индексы устройств схемы в порядке шагов.
+    bool valid = false;        ///< Собран ли план без ошибок.
+
+public:
+    /**
+     * @brief Проверяет схему и собирает план.
+     *
+     * Номера потоков совпадают с номерами @ref Flowsheet (@ref Flowsheet::streamId):
+     * сначала потоки схемы, затем найденные только в портах.
+     * @param fs Схема.
+     * @return Все найденные ошибки; план готов к работе, только если список пуст.
+     */
+    vector<PlanError> compile(const Flowsheet& fs) {
+        vector<PlanError> errors;
+        const auto& devices = fs.getDevices();
+        steps.clear(); ports.clear(); streams.clear(); deviceOrder.clear();
+        valid = false;
+
+        unordered_map<const Stream*, StreamId> ids;
+        auto idOf = [&](Stream* s) {
+            auto [it, added] = ids.emplace(s, static_cast<StreamId>(streams.size()));
+            if (added) streams.push_back(s);
+            return it->second;
+        };
+        for (const auto& s : fs.getStreams()) idOf(s.get());
+
+        const size_t n = devices.size();
+        vector<size_t> producer; // по номеру потока; SIZE_MAX — сырьё
+        for (size_t d = 0; d < n; d++) {
+            for (const auto& s : devices[d]->outputsView()) {
+                const StreamId id = idOf(s);
+                if (producer.size() <= id) producer.resize(id + 1, SIZE_MAX);
+                if (producer[id] != SIZE_MAX) {
+                    errors.push_back({PlanErrorKind::SeveralProducers, d, id,
+                                      "Stream " + s->getName() + " has several producers"});
+                } else {
+                    producer[id] = d;
+                }
+            }
+        }
+        for (size_t d = 0; d < n; d++)
+            for (const auto& s : devices[d]->inputsView()) idOf(s);
+        producer.resize(streams.size(), SIZE_MAX);
+
+        for (size_t d = 0; d < n; d++) {
+            const Device& dev = *devices[d];
+            const string name = "Device " + to_string(d) + " (" + dev.typeName() + ")";
+            if (typeid(dev) != typeid(Mixer) && typeid(dev) != typeid(Reactor)) {
+                errors.push_back({PlanErrorKind::UnsupportedDevice, d, UINT32_MAX,
+                                  name + " is not supported by plans"});
+                continue;
+            }
+            // Миксер складывает любое число входов до заявленного; выходов у миксера
+            // один, а реактор делит вход на заявленное число выходов — они точные.
+            const size_t nIn = dev.inputsView().size(), nOut = dev.outputsView().size();
+            if (nIn == 0 || nIn > static_cast<size_t>(dev.inputLimit())) {
+                errors.push_back({PlanErrorKind::InputCount, d, UINT32_MAX,
+                                  name + ": expected 1 to " + to_string(dev.inputLimit()) + " inputs, connected " + to_string(nIn)});
+            }
+            if (nOut != static_cast<size_t>(dev.outputLimit())) {
+                errors.push_back({PlanErrorKind::OutputCount, d, UINT32_MAX,
+                                  name + ": expected " + to_string(dev.outputLimit()) + " outputs, connected " + to_string(nOut)});
+            }
+        }
+
+        // Алгоритм Кана; оставшиеся устройства входят в рецикл или зависят от него.
+        vector<size_t> pending(n, 0), order;
+        vector<vector<size_t>> consumers(n);
+        for (size_t d = 0; d < n; d++) {
+            for (const auto& s : devices[d]->inputsView()) {
+                const size_t p = producer[ids.at(s)];
+                if (p == SIZE_MAX) continue;
+                consumers[p].push_back(d);
+                pending[d]++;
+            }
+        }
+        for (size_t d = 0; d < n; d++)
+            if (pending[d] == 0) order.push_back(d);
+        for (size_t i = 0; i < order.size(); i++)
+            for (size_t c : consumers[order[i]])
+                if (--pending[c] == 0) order.push_back(c);
+        for (size_t d = 0; d < n; d++) {
+            if (pending[d] != 0) {
+                errors.push_back({PlanErrorKind::RecycleLoop, d, UINT32_MAX,
+                                  "Device " + to_string(d) + " is in or downstream of a recycle loop"});
+            }
+        }
+        if (!errors.empty()) return errors;
+
+        steps.reserve(n);
+        for (size_t d : order) {
+            const Device& dev = *devices[d];
+            deviceOrder.push_back(static_cast<uint32_t>(d));
+            Step step;
+            step.inBegin = static_cast<uint32_t>(ports.size());
+            for (const auto& s : dev.inputsView()) ports.push_back(ids.at(s));
+            step.inEnd = static_cast<uint32_t>(ports.size());
+            for (const auto& s : dev.outputsView()) ports.push_back(ids.at(s));
+            step.outEnd = static_cast<uint32_t>(ports.size());
+            step.share = 1.0 / (step.outEnd - step.inEnd);
+            steps.push_back(step);
+        }
+        flows.assign(streams.size(), 0.0);
+        load();
+        valid = true;
+        return errors;
+    }
+
+    /**
+     * @brief Собран ли план без ошибок.
+     */
+    bool ready() const { return valid; }
+
+    /**
+     * @brief Переносит текущие расходы потоков схемы в план.
+     */
+    void load() {
+        for (size_t i = 0; i < streams.size(); i++) flows[i] = streams[i]->getMassFlow();
+    }
+
+    /**
+     * @brief Записывает расходы плана в потоки схемы через @ref Stream::setMassFlow.
+     * @throw std::string Если у потока задан нулевой состав, а расход в плане не нулевой.
+     */
+    void store() const {
+        for (size_t i = 0; i < streams.size(); i++) streams[i]->setMassFlow(flows[i]);
+    }
+
+    /**
+     * @brief Пересчитывает все шаги плана. Вызывать только для готового плана.
+     */
+    void execute() noexcept {
+        double* f = flows.data();
+        const StreamId* p = ports.data();
+        for (const Step& s : steps) {
+            double sum = 0.0;
+            for (uint32_t i = s.inBegin; i < s.inEnd; i++) sum += f[p[i]];
+            const double v = sum * s.share;
+            for (uint32_t o = s.inEnd; o < s.outEnd; o++) f[p[o]] = v;
+        }
+    }
+
+    /**
+     * @brief Расход потока в плане.
+     */
+    double flow(StreamId id) const noexcept { return flows[id]; }
+
+    /**
+     * @brief Задаёт расход потока в плане (обычно сырья).
+     */
+    void setFlow(StreamId id, double value) noexcept { flows[id] = value; }
+
+    /**
+     * @brief Плотный массив расходов по номерам потоков.
+     */
+    double* data() noexcept { return flows.data(); }
+
+    /**
+     * @brief Число шагов (устройств) плана.
+     */
+    size_t stepCount() const { return steps.size(); }
+
+    /**
+     * @brief Индексы устройств схемы в порядке шагов.
+     */
+    const vector<uint32_t>& order() const { return deviceOrder; }
+
+    /**
+     * @brief Число потоков плана.
+     */
+    size_t streamCount() const { return streams.size(); }
+};
+
+
+/**
+ * @struct RealtimeStats
+ * @brief Задержки циклов @ref RealtimeLoop.
+ */
+struct RealtimeStats
+{
+    uint64_t cycles = 0;   ///< Число выполненных циклов.
+    uint64_t overruns = 0; ///< Циклы, превысившие бюджет.
+    double lastNs = 0.0;   ///< Длительность последнего цикла, нс.
+    double worstNs = 0.0;  ///< Наибольшая длительность цикла, нс.
+    double meanNs = 0.0;   ///< Средняя длительность цикла, нс.
+};
+
+
+/**
+ * @class RealtimeLoop
+ * @brief Цикл управления реального времени над готовым @ref FlowsheetPlan.
+ *
+ * Всё нужное для цикла — номера сырья и выходов, буферы их значений и
+ * гистограмма задержек — выделяется в конструкторе, а сам план уже хранит
+ * плотный массив расходов. Поэтому @ref cycle не выделяет память, не бросает
+ * исключений и выполняет одну и ту же последовательность операций в каждом
+ * цикле: запись сырья, @ref FlowsheetPlan::execute, чтение выходов. Время
+ * цикла измеряется @ref ProfileClock.
+ */
+class RealtimeLoop
+{
+private:
+    FlowsheetPlan* plan;          ///< План; должен жить дольше цикла.
+    vector<StreamId> feedIds;     ///< Потоки сырья, записываемые перед пересчётом.
+    vector<StreamId> outputIds;   ///< Потоки, читаемые после пересчёта.
+    vector<double> feedValues;    ///< Значения сырья следующего цикла.
+    vector<double> outputValues;  ///< Значения выходов последнего цикла.
+    uint64_t budgetTicks;         ///< Бюджет цикла в тактах @ref ProfileClock.
+    double nsPerTick;             ///< Длительность такта, нс.
+    uint64_t cycles = 0;          ///< Число циклов.
+    uint64_t overruns = 0;        ///< Число превышений бюджета.
+    uint64_t lastTicks = 0;       ///< Длительность последнего цикла.
+    uint64_t worstTicks = 0;      ///< Наибольшая длительность цикла.
+    uint64_t totalTicks = 0;      ///< Суммарная длительность циклов.
+    array<uint64_t, 64> histogram{}; ///< Число циклов по разрядности длительности в нс.
+
+    /**
+     * @brief Проверяет номера потоков на этапе настройки.
+     */
+    void check(const vector<StreamId>& ids) const {
+        for (StreamId id : ids) {
+            if (id >= plan->streamCount()) throw "Stream " + to_string(id) + " is not in the plan";
+        }
+    }
+
+public:
+    /**
+     * @brief Настраивает цикл и выполняет один прогревочный пересчёт (в статистику не входит).
+     *
+     * Начальные значения сырья берутся из плана.
+     * @param p Готовый план.
+     * @param feeds Номера потоков сырья.
+     * @param outputs Номера потоков, значения которых нужны после каждого цикла.
+     * @param budget Бюджет времени одного цикла.
+     * @throw std::string Если план не готов или номер потока вне плана.
+     */
+    RealtimeLoop(FlowsheetPlan& p, vector<StreamId> feeds, vector<StreamId> outputs,
+                 chrono::nanoseconds budget = chrono::milliseconds(1))
+        : plan(&p), feedIds(move(feeds)), outputIds(move(outputs)) {
+        if (!plan->ready()) throw "Plan is not compiled"s;
+        check(feedIds);
+        check(outputIds);
+        nsPerTick = ProfileClock::nanosPerTick();
+        budgetTicks = static_cast<uint64_t>(double(budget.count()) / nsPerTick);
+        feedValues.resize(feedIds.size());
+        outputValues.resize(outputIds.size());
+        for (size_t i = 0; i < feedIds.size(); i++) feedValues[i] = plan->flow(feedIds[i]);
+        cycle();
+        resetStats();
+    }
+
+    /**
+     * @brief Значения сырья следующего цикла, по одному на номер из конструктора.
+     */
+    double* feeds() noexcept { return feedValues.data(); }
+
+    /**
+     * @brief Значения выходов после последнего цикла, по одному на номер из конструктора.
+     */
+    const double* outputs() const noexcept { return outputValues.data(); }
+
+    /**
+     * @brief Выполняет один цикл: записывает сырьё, пересчитывает план, читает выходы.
+     * @return Уложился ли цикл в бюджет.
+     */
+    bool cycle() noexcept {
+        const uint64_t start = ProfileClock::now();
+        double* f = plan->data();
+        for (size_t i = 0; i < feedIds.size(); i++) f[feedIds[i]] = feedValues[i];
+        plan->execute();
+        for (size_t i = 0; i < outputIds.size(); i++) outputValues[i] = f[outputIds[i]];
+        const uint64_t ticks = ProfileClock::now() - start;
+
+        cycles++;
+        lastTicks = ticks;
+        worstTicks = max(worstTicks, ticks);
+        totalTicks += ticks;
+        size_t bucket = 0;
+        for (uint64_t ns = static_cast<uint64_t>(double(ticks) * nsPerTick); ns > 1; ns >>= 1) bucket++;
+        histogram[bucket]++;
+        const bool inBudget = ticks <= budgetTicks;
+        overruns += !inBudget;
+        return inBudget;
+    }
+
+    /**
+     * @brief Статистика задержек с последнего @ref resetStats.
+     */
+    RealtimeStats stats() const noexcept {
+        RealtimeStats s;
+        s.cycles = cycles;
+        s.overruns = overruns;
+        s.lastNs = double(lastTicks) * nsPerTick;
+        s.worstNs = double(worstTicks) * nsPerTick;
+        s.meanNs = cycles ? double(totalTicks) * nsPerTick / double(cycles) : 0.0;
+        return s;
+    }
+
+    /**
+     * @brief Верхняя граница задержки, в которую уложилась доля @p q циклов.
+     * @param q Доля от 0 до 1, например 0.99.
+     * @return Граница в нс с точностью до степени двойки; 0, если циклов не было.
+     */
+    double latencyBound(double q) const noexcept {
+        const double target = q * double(cycles);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < histogram.size(); b++) {
+            seen += histogram[b];
+            if (seen > 0 && double(seen) >= target) return ldexp(1.0, static_cast<int>(b) + 1);
+        }
+        return 0.0;
+    }
+
+    /**
+     * @brief Обнуляет статистику задержек.
+     */
+    void resetStats() noexcept {
+        cycles = overruns = lastTicks = worstTicks = totalTicks = 0;
+        histogram.fill(0);
+    }
+};
+
+
+/**
+ * @class MappedFile
+ * @brief Файл, отображённый в память целиком (mmap в POSIX, CreateFileMapping в Windows).
+ *
+ * Отображение частное с копированием при записи: изменения в памяти видны
+ * только процессу и в файл не попадают.
+ */
+class MappedFile
+{
+private:
+    char* base = nullptr; ///< Начало отображения.
+    size_t length = 0;    ///< Длина файла.
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE; ///< Открытый файл.
+    HANDLE mapping = nullptr;           ///< Объект отображения.
+#else
+    int fd = -1;                        ///< Открытый файл.
+#endif
+
+public:
+    /**
+     * @param path Путь к файлу.
+     * @throw std::string Если файл не открывается, пуст или не отображается.
+     */
+    explicit MappedFile(const string& path) {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) throw "Cannot open " + path;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            throw "Cannot map empty file " + path;
+        }
+        length = static_cast<size_t>(size.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (mapping) base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+        if (!base) {
+            if (mapping) CloseHandle(mapping);
+            CloseHandle(file);
+            throw "Cannot map " + path;
+        }
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw "Cannot open " + path;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw "Cannot map empty file " + path;
+        }
+        length = static_cast<size_t>(st.st_size);
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw "Cannot map " + path;
+        }
+        base = static_cast<char*>(p);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        UnmapViewOfFile(base);
+        CloseHandle(mapping);
+        CloseHandle(file);
+#else
+        munmap(base, length);
+        close(fd);
+#endif
+    }
+
+    /**
+     * @brief Начало отображения.
+     */
+    char* data() { return base; }
+    const char* data() const { return base; }
+
+    /**
+     * @brief Длина файла в байтах.
+     */
+    size_t size() const { return length; }
+};
+
+
+/**
+ * @struct SnapshotHeader
+ * @brief Заголовок файла снимка схемы. Все секции выровнены на 8 байт.
+ */
+struct SnapshotHeader
+{
+    char magic[8];            ///< "LDSNAP" и два нулевых байта.
+    uint32_t version;         ///< Версия формата.
+    uint32_t byteOrder;       ///< 0x01020304 в порядке байт записавшей машины.
+    uint64_t fileSize;        ///< Полный размер файла.
+    uint64_t deviceCount;     ///< Число устройств.
+    uint64_t streamCount;     ///< Число потоков.
+    uint64_t portCount;       ///< Число записей в секции портов.
+    uint64_t orderCount;      ///< Длина порядка пересчёта: число устройств либо 0, если план не строится.
+    uint64_t namesSize;       ///< Размер блока имён в байтах.
+    uint64_t devicesOffset;   ///< Секция @ref SnapshotDevice.
+    uint64_t portsOffset;     ///< Номера потоков портов (uint32).
+    uint64_t orderOffset;     ///< Индексы устройств в порядке пересчёта (uint32).
+    uint64_t flowsOffset;     ///< Расходы потоков (double).
+    uint64_t streamNamesOffset; ///< Смещения имён потоков в блоке имён (uint32).
+    uint64_t namesOffset;     ///< Блок имён, строки завершаются нулём; смещение 0 — пустое имя.
+};
+
+/**
+ * @struct SnapshotDevice
+ * @brief Запись об устройстве в снимке.
+ */
+struct SnapshotDevice
+{
+    uint32_t kind;        ///< 0 — @ref Mixer, 1 — @ref Reactor.
+    uint32_t inputLimit;  ///< Заявленное число входов.
+    uint32_t outputLimit; ///< Заявленное число выходов.
+    uint32_t firstPort;   ///< Начало портов: входы, затем выходы.
+    uint32_t inputs;      ///< Число подключённых входов.
+    uint32_t outputs;     ///< Число подключённых выходов.
+    uint32_t name;        ///< Смещение имени в блоке имён.
+    uint32_t reserved;    ///< Выравнивание.
+};
+
+
+/**
+ * @class FlowsheetSnapshot
+ * @brief Двоичный снимок схемы (устройства, порты, расходы и имена), используемый прямо из отображённого файла.
+ *
+ * Открытие снимка — это отображение файла и однократная проверка заголовка и
+ * индексов без разбора и выделения памяти под модель; схему можно сразу
+ * пересчитывать на месте (@ref execute) или, при необходимости объектного
+ * интерфейса, перенести в @ref Flowsheet (@ref load). Номера потоков и порядок
+ * устройств совпадают с исходной схемой. Сохраняются только миксеры и реакторы
+ * и суммарные расходы; составы и реакции в снимок не входят.
+ */
+class FlowsheetSnapshot
+{
+private:
+    static constexpr uint32_t formatVersion = 1; ///< Текущая версия формата.
+
+    MappedFile file;                          ///< Отображённый файл.
+    const SnapshotHeader* header = nullptr;   ///< Заголовок.
+    const SnapshotDevice* devices = nullptr;  ///< Устройства.
+    const uint32_t* ports = nullptr;          ///< Номера потоков портов.
+    const uint32_t* order = nullptr;          ///< Порядок пересчёта.
+    double* flows = nullptr;                  ///< Расходы (копия при записи).
+    const uint32_t* streamNames = nullptr;    ///< Смещения имён потоков.
+    const char* names = nullptr;              ///< Блок имён.
+
+    static size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+    /**
+     * @brief Проверяет, что секция из @p count элементов по @p size байт лежит в файле.
+     */
+    void checkSection(uint64_t offset, uint64_t count, uint64_t size) const {
+        if (offset % 8 != 0 || offset > file.size() || count > (file.size() - offset) / size) {
+            throw "Snapshot section is out of file bounds"s;
+        }
+    }
+
+    /**
+     * @brief Проверяет заголовок и индексы снимка.
+     */
+    void validate() {
+        if (file.size() < sizeof(SnapshotHeader)) throw "Snapshot file is too small"s;
+        header = reinterpret_cast<const SnapshotHeader*>(file.data());
+        if (memcmp(header->magic, "LDSNAP\0\0", 8) != 0) throw "Not a flowsheet snapshot"s;
+        if (header->version != formatVersion) throw "Unsupported snapshot version"s;
+        if (header->byteOrder != 0x01020304u) throw "Snapshot has foreign byte order"s;
+        if (header->fileSize != file.size()) throw "Snapshot file is truncated"s;
+        const uint64_t nd = header->deviceCount, ns = header->streamCount, np = header->portCount;
+        if (ns >= NO_STREAM || np > UINT32_MAX || (header->orderCount != 0 && header->orderCount != nd)) {
+            throw "Snapshot header is inconsistent"s;
+        }
+        checkSection(header->devicesOffset, nd, sizeof(SnapshotDevice));
+        checkSection(header->portsOffset, np, sizeof(uint32_t));
+        checkSection(header->orderOffset, header->orderCount, sizeof(uint32_t));
+        checkSection(header->flowsOffset, ns, sizeof(double));
+        checkSection(header->streamNamesOffset, ns, sizeof(uint32_t));
+        checkSection(header->namesOffset, header->namesSize, 1);
+
+        char* base = file.data();
+        devices = reinterpret_cast<const SnapshotDevice*>(base + header->devicesOffset);
+        ports = reinterpret_cast<const uint32_t*>(base + header->portsOffset);
+        order = reinterpret_cast<const uint32_t*>(base + header->orderOffset);
+        flows = reinterpret_cast<double*>(base + header->flowsOffset);
+        streamNames = reinterpret_cast<const uint32_t*>(base + header->streamNamesOffset);
+        names = base + header->namesOffset;
+
+        if (header->namesSize == 0 || names[header->namesSize - 1] != '\0') throw "Snapshot names are corrupt"s;
+        for (uint64_t d = 0; d < nd; d++) {
+            const SnapshotDevice& dev = devices[d];
+            if (dev.kind > 1 || uint64_t(dev.firstPort) + dev.inputs + dev.outputs > np ||
+                dev.name >= header->namesSize) {
+                throw "Snapshot device " + to_string(d) + " is corrupt";
+            }
+        }
+        for (uint64_t p = 0; p < np; p++)
+            if (ports[p] >= ns) throw "Snapshot port refers to a missing stream"s;
+        for (uint64_t k = 0; k < header->orderCount; k++)
+            if (order[k] >= nd) throw "Snapshot order refers to a missing device"s;
+        for (uint64_t i = 0; i < ns; i++)
+            if (streamNames[i] >= header->namesSize) throw "Snapshot names are corrupt"s;
+    }
+
+public:
+    /**
+     * @brief Открывает снимок.
+     * @param path Путь к файлу, записанному @ref write.
+     * @throw std::string Если файл недоступен или повреждён.
+     */
+    explicit FlowsheetSnapshot(const string& path): file(path) { validate(); }
+
+    /**
+     * @brief Записывает снимок схемы.
+     * @param fs Схема из миксеров и реакторов.
+     * @param path Путь к файлу.
+     * @throw std::string Если в схеме есть устройства других видов или файл не записывается.
+     */
+    static void write(const Flowsheet& fs, const string& path) {
+        const auto& devs = fs.getDevices();
+        unordered_map<const Stream*, StreamId> ids;
+        vector<const Stream*> streams;
+        auto idOf = [&](Stream* s) {
+            auto [it, added] = ids.emplace(s, static_cast<StreamId>(streams.size()));
+            if (added) streams.push_back(s);
+            return it->second;
+        };
+        for (const auto& s : fs.getStreams()) idOf(s.get());
+        for (const auto& d : devs)
+            for (const auto& s : d->outputsView()) idOf(s);
+        for (const auto& d : devs)
+            for (const auto& s : d->inputsView()) idOf(s);
+
+        string blob(1, '\0');
+        auto nameOf = [&blob](const string& s) {
+            if (s.empty()) return uint32_t(0);
+            if (blob.size() + s.size() + 1 > UINT32_MAX) throw "Snapshot names exceed 4 GiB"s;
+            const uint32_t offset = static_cast<uint32_t>(blob.size());
+            blob.append(s).push_back('\0');
+            return offset;
+        };
+
+        vector<SnapshotDevice> table(devs.size());
+        vector<uint32_t> portIds;
+        for (size_t d = 0; d < devs.size(); d++) {
+            const Device& dev = *devs[d];
+            if (typeid(dev) != typeid(Mixer) && typeid(dev) != typeid(Reactor)) {
+                throw "Snapshot supports only Mixer and Reactor devices"s;
+            }
+            table[d] = {typeid(dev) == typeid(Mixer) ? 0u : 1u,
+                        static_cast<uint32_t>(dev.inputLimit()), static_cast<uint32_t>(dev.outputLimit()),
+                        static_cast<uint32_t>(portIds.size()),
+                        static_cast<uint32_t>(dev.inputsView().size()), static_cast<uint32_t>(dev.outputsView().size()),
+                        nameOf(dev.getName()), 0};
+            for (const auto& s : dev.inputsView()) portIds.push_back(ids.at(s));
+            for (const auto& s : dev.outputsView()) portIds.push_back(ids.at(s));
+        }
+
+        vector<double> flowValues(streams.size());
+        vector<uint32_t> nameOffsets(streams.size());
+        for (size_t i = 0; i < streams.size(); i++) {
+            flowValues[i] = streams[i]->getMassFlow();
+            nameOffsets[i] = nameOf(streams[i]->getName());
+        }
+
+        FlowsheetPlan plan;
+        vector<uint32_t> orderIds;
+        if (plan.compile(fs).empty()) orderIds = plan.order();
+
+        SnapshotHeader h{};
+        memcpy(h.magic, "LDSNAP\0\0", 8);
+        h.version = formatVersion;
+        h.byteOrder = 0x01020304u;
+        h.deviceCount = table.size();
+        h.streamCount = streams.size();
+        h.portCount = portIds.size();
+        h.orderCount = orderIds.size();
+        h.namesSize = blob.size();
+        size_t at = align8(sizeof(SnapshotHeader));
+        h.devicesOffset = at;     at = align8(at + table.size() * sizeof(SnapshotDevice));
+        h.portsOffset = at;       at = align8(at + portIds.size() * sizeof(uint32_t));
+        h.orderOffset = at;       at = align8(at + orderIds.size() * sizeof(uint32_t));
+        h.flowsOffset = at;       at = align8(at + flowValues.size() * sizeof(double));
+        h.streamNamesOffset = at; at = align8(at + nameOffsets.size() * sizeof(uint32_t));
+        h.namesOffset = at;       at = align8(at + blob.size());
+        h.fileSize = at;
+
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) throw "Cannot write " + path;
+        auto section = [&out](const void* p, size_t bytes) {
+            static const char zeros[8] = {};
+            out.write(static_cast<const char*>(p), static_cast<streamsize>(bytes));
+            out.write(zeros, static_cast<streamsize>(align8(bytes) - bytes));
+        };
+        section(&h, sizeof h);
+        section(table.data(), table.size() * sizeof(SnapshotDevice));
+        section(portIds.data(), portIds.size() * sizeof(uint32_t));
+        section(orderIds.data(), orderIds.size() * sizeof(uint32_t));
+        section(flowValues.data(), flowValues.size() * sizeof(double));
+        section(nameOffsets.data(), nameOffsets.size() * sizeof(uint32_t));
+        section(blob.data(), blob.size());
+        if (!out.flush()) throw "Cannot write " + path;
+    }
+
+    /**
+     * @brief Число устройств.
+     */
+    size_t deviceCount() const { return header->deviceCount; }
+
+    /**
+     * @brief Число потоков.
+     */
+    size_t streamCount() const { return header->streamCount; }
+
+    /**
+     * @brief Запись об устройстве.
+     */
+    const SnapshotDevice& device(size_t d) const { return devices[d]; }
+
+    /**
+     * @brief Номера входных потоков устройства.
+     */
+    PortView<StreamId> inputs(size_t d) const {
+        const uint32_t* p = ports + devices[d].firstPort;
+        return {p, p + devices[d].inputs};
+    }
+
+    /**
+     * @brief Номера выходных потоков устройства.
+     */
+    PortView<StreamId> outputs(size_t d) const {
+        const uint32_t* p = ports + devices[d].firstPort + devices[d].inputs;
+        return {p, p + devices[d].outputs};
+    }
+
+    /**
+     * @brief Имя потока (указывает в отображённый файл).
+     */
+    string_view streamName(StreamId id) const { return names + streamNames[id]; }
+
+    /**
+     * @brief Имя устройства (пустое, если не задано).
+     */
+    string_view deviceName(size_t d) const { return names + devices[d].name; }
+
+    /**
+     * @brief Расходы потоков на месте; изменения не записываются в файл.
+     */
+    double* data() { return flows; }
+
+    /**
+     * @brief Можно ли пересчитывать снимок на месте (схема была ациклической и с полными портами).
+     */
+    bool executable() const { return header->orderCount == header->deviceCount; }
+
+    /**
+     * @brief Пересчитывает схему прямо над отображёнными массивами, как @ref FlowsheetPlan::execute.
+     *        Вызывать только для @ref executable снимка.
+     */
+    void execute() noexcept {
+        for (uint64_t k = 0; k < header->orderCount; k++) {
+            const SnapshotDevice& dev = devices[order[k]];
+            const uint32_t* p = ports + dev.firstPort;
+            double sum = 0.0;
+            for (uint32_t i = 0; i < dev.inputs; i++) sum += flows[p[i]];
+            const double v = sum * (1.0 / dev.outputs);
+            for (uint32_t o = 0; o < dev.outputs; o++) flows[p[dev.inputs + o]] = v;
+        }
+    }
+
+    /**
+     * @brief Переносит снимок в схему: создаёт потоки, устройства и подключения.
+     *
+     * Имена вида «s<номер>» восстанавливаются как имена по умолчанию и в
+     * @ref GlobalNames не добавляются.
+     * @param fs Схема; номера новых потоков сдвинуты на число уже имевшихся в ней потоков.
+     * @return Номер первого созданного потока.
+     */
+    StreamId load(Flowsheet& fs) const {
+        const StreamId base = static_cast<StreamId>(fs.getStreams().size());
+        fs.reserve(base + streamCount(), fs.getDevices().size() + deviceCount());
+        for (StreamId i = 0; i < streamCount(); i++) {
+            Stream& s = fs.stream(fs.newStream(flows[i]));
+            const uint32_t number = GlobalNames::numbered(streamName(i));
+            if (number != 0) s.setNumber(number & ~GlobalNames::NUMBERED);
+            else s.setName(streamName(i));
+        }
+        for (size_t d = 0; d < deviceCount(); d++) {
+            const SnapshotDevice& rec = devices[d];
+            Device& dev = rec.kind == 0 ? static_cast<Device&>(fs.newMixer(static_cast<int>(rec.inputLimit)))
+                                        : static_cast<Device&>(fs.newReactor(rec.outputLimit == 2));
+            if (rec.name != 0) dev.setName(deviceName(d));
+            for (StreamId id : inputs(d)) fs.connectInput(dev, base + id);
+            for (StreamId id : outputs(d)) fs.connectOutput(dev, base + id);
+        }
+        return base;
+    }
+};
+
+
+/**
+ * @struct FlowsheetParseError
+ * @brief Ошибка разбора текстового описания схемы с точной позицией.
+ */
+struct FlowsheetParseError
+{
+    size_t line;    ///< Номер строки, с 1.
+    size_t column;  ///< Номер столбца (байта) в строке, с 1.
+    string message; ///< Описание.
+
+    /**
+     * @brief Сообщение вида "строка:столбец: описание".
+     */
+    string what() const { return to_string(line) + ":" + to_string(column) + ": " + message; }
 };
 
 
+/**
+ * @class FlowsheetTextReader
+ * @brief Однопроходный потоковый разбор текстового описания схемы.
+ *
+ * Формат построчный, лексемы разделяются пробелами и табуляциями, @c # начинает комментарий:
+ * @code
+ * stream <имя> <расход>                  # начальный расход потока
+ * mixer <имя> <вход>... -> <выход>
+ * reactor <имя> <вход> -> <выход> [<выход>]
+ * @endcode
+ * Поток создаётся при первом упоминании с нулевым расходом; строка @c stream
+ * задаёт расход и для каждого потока допустима один раз. Вход читается
+ * блоками, лексемы — представления в буфер, так что на строку не выделяется
+ * память; выделяются только сами потоки и устройства.
+ */
+class FlowsheetTextReader
+{
+private:
+    /**
+     * @struct Token
+     * @brief Лексема строки.
+     */
+    struct Token
+    {
+        string_view text; ///< Текст в буфере чтения.
+        size_t column;    ///< Столбец начала, с 1.
+    };
+
+    Flowsheet& fs;                                 ///< Заполняемая схема.
+    size_t chunk;                                  ///< Размер блока чтения.
+    size_t line = 0;                               ///< Номер текущей строки.
+    vector<Token> tokens;                          ///< Лексемы текущей строки (ёмкость переиспользуется).
+    unordered_map<string_view, StreamId> streams;  ///< Имя → поток; ключи — строки @ref GlobalNames.
+    unordered_set<uint32_t> devices;               ///< Номера имён устройств в @ref GlobalNames.
+    StreamId base;                                 ///< Номер первого потока, созданного разбором.
+    vector<char> produced;                         ///< По номеру потока − @ref base: есть ли у него производитель.
+    vector<char> declared;                         ///< По номеру потока − @ref base: была ли строка @c stream.
+
+    [[noreturn]] void fail(size_t column, string message) const {
+        throw FlowsheetParseError{line, column, move(message)};
+    }
+
+    /**
+     * @brief Поток по имени; создаётся при первом упоминании.
+     */
+    StreamId streamOf(const Token& t) {
+        auto it = streams.find(t.text);
+        if (it != streams.end()) return it->second;
+        const StreamId id = fs.newStream(t.text, 0.0);
+        streams.emplace(GlobalNames::get(fs.stream(id).getNameId()), id);
+        produced.push_back(0);
+        declared.push_back(0);
+        return id;
+    }
+
+    /**
+     * @brief Запоминает имя устройства, проверяя единственность.
+     */
+    void nameDevice(Device& d, const Token& t) {
+        d.setName(t.text);
+        if (!devices.insert(d.getNameId()).second) fail(t.column, "Device " + string(t.text) + " is already defined");
+    }
+
+    /**
+     * @brief Разбирает одну строку без завершающего перевода строки.
+     */
+    void parseLine(const char* p, size_t n) {
+        line++;
+        tokens.clear();
+        for (size_t i = 0; i < n;) {
+            const char c = p[i];
+            if (c == '#') break;
+            if (c == ' ' || c == '\t' || c == '\r') { i++; continue; }
+            const size_t b = i;
+            while (i < n && p[i] != ' ' && p[i] != '\t' && p[i] != '\r' && p[i] != '#') i++;
+            tokens.push_back({string_view(p + b, i - b), b + 1});
+        }
+        if (tokens.empty()) return;
+
+        const Token& kw = tokens[0];
+        if (kw.text == "stream") {
+            if (tokens.size() != 3) fail(kw.column, "Expected: stream <name> <flow>");
+            const StreamId id = streamOf(tokens[1]);
+            if (exchange(declared[id - base], 1)) fail(tokens[1].column, "Stream " + string(tokens[1].text) + " is already declared");
+            fs.stream(id).setMassFlow(number(tokens[2]));
+            return;
+        }
+        const bool mixer = kw.text == "mixer";
+        if (!mixer && kw.text != "reactor") fail(kw.column, "Unknown keyword '" + string(kw.text) + "'");
+        if (tokens.size() < 2 || tokens[1].text == "->") fail(kw.column, "Device name expected");
+
+        size_t arrow = 2;
+        while (arrow < tokens.size() && tokens[arrow].text != "->") arrow++;
+        if (arrow == tokens.size()) fail(tokens.back().column + tokens.back().text.size(), "'->' expected");
+        const size_t nIn = arrow - 2, nOut = tokens.size() - arrow - 1;
+        if (nIn == 0) fail(tokens[arrow].column, "At least one input expected");
+        if (nOut == 0) fail(tokens[arrow].column + 2, "At least one output expected");
+        if (mixer && nOut > size_t(MIXER_OUTPUTS)) fail(tokens[arrow + 1 + MIXER_OUTPUTS].column, "Mixer has one output");
+        if (!mixer && nIn > 1) fail(tokens[3].column, "Reactor has one input");
+        if (!mixer && nOut > 2) fail(tokens[arrow + 3].column, "Reactor has at most two outputs");
+
+        Device& d = mixer ? static_cast<Device&>(fs.newMixer(static_cast<int>(nIn)))
+                          : static_cast<Device&>(fs.newReactor(nOut == 2));
+        nameDevice(d, tokens[1]);
+        for (size_t i = 2; i < arrow; i++) fs.connectInput(d, streamOf(tokens[i]));
+        for (size_t i = arrow + 1; i < tokens.size(); i++) {
+            const StreamId id = streamOf(tokens[i]);
+            if (exchange(produced[id - base], 1)) fail(tokens[i].column, "Stream " + string(tokens[i].text) + " already has a producer");
+            fs.connectOutput(d, id);
+        }
+    }
+
+    /**
+     * @brief Разбирает неотрицательное число.
+     */
+    double number(const Token& t) const {
+        char text[64];
+        if (t.text.size() >= sizeof text) fail(t.column, "Number is too long");
+        memcpy(text, t.text.data(), t.text.size());
+        text[t.text.size()] = '\0';
+        char* end = nullptr;
+        const double v = strtod(text, &end);
+        if (end != text + t.text.size() || !isfinite(v) || v < 0) {
+            fail(t.column, "Non-negative number expected, got '" + string(t.text) + "'");
+        }
+        return v;
+    }
+
+public:
+    /**
+     * @param flowsheet Схема, в которую добавляются потоки и устройства.
+     * @param chunkSize Размер блока чтения в байтах.
+     */
+    explicit FlowsheetTextReader(Flowsheet& flowsheet, size_t chunkSize = size_t(1) << 20)
+        : fs(flowsheet), chunk(max<size_t>(chunkSize, 16)), base(static_cast<StreamId>(flowsheet.getStreams().size())) {}
+
+    /**
+     * @brief Читает описание до конца потока ввода.
+     * @param in Поток ввода.
+     * @return Число прочитанных строк.
+     * @throw FlowsheetParseError При ошибке синтаксиса или чтения.
+     */
+    size_t read(istream& in) {
+        vector<char> buf(chunk);
+        size_t have = 0;
+        for (;;) {
+            in.read(buf.data() + have, static_cast<streamsize>(buf.size() - have));
+            have += static_cast<size_t>(in.gcount());
+            if (in.bad()) fail(0, "Read error");
+            const bool end = !in;
+            size_t start = 0;
+            while (const void* nl = memchr(buf.data() + start, '\n', have - start)) {
+                const size_t at = static_cast<size_t>(static_cast<const char*>(nl) - buf.data());
+                parseLine(buf.data() + start, at - start);
+                start = at + 1;
+            }
+            if (end) {
+                if (start < have) parseLine(buf.data() + start, have - start);
+                return line;
+            }
+            memmove(buf.data(), buf.data() + start, have - start);
+            have -= start;
+            if (have == buf.size()) buf.resize(buf.size() * 2); // строка длиннее блока
+        }
+    }
+
+    /**
+     * @brief Читает описание из файла.
+     * @param path Путь к файлу.
+     * @throw FlowsheetParseError Если файл не открывается или содержит ошибку.
+     */
+    size_t readFile(const string& path) {
+        ifstream in(path, ios::binary);
+        if (!in) throw FlowsheetParseError{0, 0, "Cannot open " + path};
+        return read(in);
+    }
+
+    /**
+     * @brief Находит поток, описанный в тексте, по имени.
+     * @return Номер потока либо @ref NO_STREAM.
+     */
+    StreamId stream(string_view name) const {
+        auto it = streams.find(name);
+        return it == streams.end() ? NO_STREAM : it->second;
+    }
+};
+
+
+/**
+ * @brief Записывает схему в текстовом формате @ref FlowsheetTextReader.
+ *
+ * Сначала перечисляются все потоки в порядке номеров, поэтому при чтении
+ * номера потоков совпадают с исходными. Устройствам без имени даются имена "d<индекс>".
+ * @param fs Схема из миксеров и реакторов с уникальными именами потоков без пробелов;
+ *           у каждого устройства подключены все заявленные выходы.
+ * @param os Поток вывода.
+ * @throw std::string Если схему нельзя записать в этом формате.
+ */
+inline void writeFlowsheetText(const Flowsheet& fs, ostream& os) {
+    auto checkName = [](const string& name) {
+        if (name.empty() || name == "->" || name.find_first_of(" \t\r\n#") != string::npos) {
+            throw "Name '" + name + "' cannot be written as text";
+        }
+    };
+    unordered_set<string> seen;
+    unordered_set<string> deviceNames;
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << setprecision(17);
+    for (const auto& s : fs.getStreams()) {
+        checkName(s->getName());
+        if (!seen.insert(s->getName()).second) throw "Stream name " + s->getName() + " is not unique";
+        os << "stream " << s->getName() << " " << s->getMassFlow() << "\n";
+    }
+    for (size_t d = 0; d < fs.getDevices().size(); d++) {
+        const Device& dev = *fs.getDevices()[d];
+        if (typeid(dev) != typeid(Mixer) && typeid(dev) != typeid(Reactor)) {
+            throw "Text format supports only Mixer and Reactor devices"s;
+        }
+        for (const auto& s : dev.inputsView())
+            if (!seen.count(s->getName())) throw "Stream " + s->getName() + " is not part of the flowsheet";
+        for (const auto& s : dev.outputsView())
+            if (!seen.count(s->getName())) throw "Stream " + s->getName() + " is not part of the flowsheet";
+        if (dev.inputsView().empty() || dev.outputsView().empty()) {
+            throw "Device " + to_string(d) + " has unconnected ports";
+        }
+        if (dev.outputsView().size() != static_cast<size_t>(dev.outputLimit())) {
+            // Число выходов реактора при чтении берётся из числа подключённых.
+            throw "Device " + to_string(d) + ": expected " + to_string(dev.outputLimit()) +
+                  " outputs, connected " + to_string(dev.outputsView().size());
+        }
+        const string name = dev.getName().empty() ? "d" + to_string(d) : dev.getName();
+        checkName(name);
+        if (!deviceNames.insert(name).second) throw "Device name " + name + " is not unique";
+        os << (typeid(dev) == typeid(Mixer) ? "mixer " : "reactor ") << name;
+        for (const auto& s : dev.inputsView()) os << " " << s->getName();
+        os << " ->";
+        for (const auto& s : dev.outputsView()) os << " " << s->getName();
+        os << "\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+
 /**
  * @test
  * @brief Проверяет, что Mixer с одним выходом устанавливает суммарный расход входов на выход.
@@ -396,6 +5280,7 @@ void tests(){
     shouldCorrectInputs();
 }
 
+#ifndef UNIT_TESTS
 /**
  * @brief Точка входа в программу.
  * @return 0 при успешном завершении.
@@ -430,3 +5315,4 @@ int main()
 
     return 0;
 }
+#endif
@@ -1,4 +1,7 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 #include <sstream>
 #include <stdexcept>
 
@@ -7,6 +10,79 @@
 
 static constexpr double EPS = 1e-2;
 
+// ---------- Подсчёт выделений памяти ----------
+// Глобальные operator new/delete заменены на подсчитывающие, чтобы тесты
+// «горячего пути» могли проверить, что пересчёт после настройки не выделяет память.
+static std::atomic<size_t> g_allocations{0};
+
+static void* countedAlloc(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void* countedAlignedAlloc(std::size_t size, std::align_val_t a) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t align = static_cast<std::size_t>(a);
+    const std::size_t rounded = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+#if defined(_WIN32)
+    void* p = _aligned_malloc(rounded, align);
+#else
+    void* p = std::aligned_alloc(align, rounded);
+#endif
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void alignedFree(void* p) noexcept {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* operator new(std::size_t size) { return countedAlloc(size); }
+void* operator new[](std::size_t size) { return countedAlloc(size); }
+void* operator new(std::size_t size, std::align_val_t a) { return countedAlignedAlloc(size, a); }
+void* operator new[](std::size_t size, std::align_val_t a) { return countedAlignedAlloc(size, a); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try { return countedAlloc(size); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try { return countedAlloc(size); } catch (...) { return nullptr; }
+}
+void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept {
+    try { return countedAlignedAlloc(size, a); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept {
+    try { return countedAlignedAlloc(size, a); } catch (...) { return nullptr; }
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { alignedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { alignedFree(p); }
+
+/**
+ * @brief Число выделений памяти с момента создания.
+ */
+class AllocationCounter
+{
+    size_t start = g_allocations.load(std::memory_order_relaxed);
+
+public:
+    size_t count() const { return g_allocations.load(std::memory_order_relaxed) - start; }
+};
+
 // ---------- Stream ----------
 TEST(StreamUnit, AutoNameFromIndex) {
     Stream s1(1);
@@ -186,3 +262,1592 @@ TEST(DeviceAPI, GettersReturnCopiesWithExpectedSize) {
     EXPECT_EQ(ins[0]->getName(), "s1");
     EXPECT_EQ(outs[0]->getName(), "s3");
 }
+
+// ---------- Flowsheet ----------
+TEST(FlowsheetSchedule, RunsDevicesInTopologicalOrder) {
+    streamcounter = 0;
+    auto feed1 = std::make_shared<Stream>(++streamcounter);
+    auto feed2 = std::make_shared<Stream>(++streamcounter);
+    auto mixed = std::make_shared<Stream>(++streamcounter);
+    auto p1    = std::make_shared<Stream>(++streamcounter);
+    auto p2    = std::make_shared<Stream>(++streamcounter);
+    feed1->setMassFlow(6.0);
+    feed2->setMassFlow(4.0);
+
+    auto rx = std::make_shared<Reactor>(true);
+    auto mx = std::make_shared<Mixer>(2);
+    rx->addInput(mixed); rx->addOutput(p1); rx->addOutput(p2);
+    mx->addInput(feed1); mx->addInput(feed2); mx->addOutput(mixed);
+
+    Flowsheet fs;
+    fs.addDevice(rx);                                   // реактор добавлен раньше миксера
+    fs.addDevice(mx);
+    fs.run();
+
+    const auto& order = fs.schedule();
+    ASSERT_EQ(order.size(), 2u);
+    EXPECT_EQ(order[0], mx.get());
+    EXPECT_EQ(order[1], rx.get());
+    EXPECT_EQ(fs.getStreams().size(), 5u);              // потоки найдены по портам
+    EXPECT_NEAR(p1->getMassFlow(), 5.0, EPS);
+    EXPECT_NEAR(p2->getMassFlow(), 5.0, EPS);
+}
+
+TEST(FlowsheetSchedule, RecycleLoopThrowsStdString) {
+    auto a = std::make_shared<Stream>(1);
+    auto b = std::make_shared<Stream>(2);
+    auto r1 = std::make_shared<Reactor>(false);
+    auto r2 = std::make_shared<Reactor>(false);
+    r1->addInput(a); r1->addOutput(b);
+    r2->addInput(b); r2->addOutput(a);
+
+    Flowsheet fs;
+    fs.addDevice(r1);
+    fs.addDevice(r2);
+    EXPECT_THROW(fs.run(), std::string);
+}
+
+TEST(FlowsheetSchedule, StreamWithTwoProducersThrowsStdString) {
+    auto in1 = std::make_shared<Stream>(1);
+    auto in2 = std::make_shared<Stream>(2);
+    auto out = std::make_shared<Stream>(3);
+    auto r1 = std::make_shared<Reactor>(false);
+    auto r2 = std::make_shared<Reactor>(false);
+    r1->addInput(in1); r1->addOutput(out);
+    r2->addInput(in2); r2->addOutput(out);
+
+    Flowsheet fs;
+    fs.addDevice(r1);
+    fs.addDevice(r2);
+    EXPECT_THROW(fs.schedule(), std::string);
+}
+
+// ---------- StreamTable ----------
+TEST(StreamTableUnit, NamesAreInternedOnce) {
+    StreamTable t;
+    StreamId a = t.add("feed", 1.0);
+    StreamId b = t.add("feed", 2.0);
+    t.setMassFlow(b, 3.0);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(t.getName(a), "feed");
+    EXPECT_EQ(t.getNameId(a), t.getNameId(b));          // одна строка в пуле
+    EXPECT_NEAR(t.data()[b], 3.0, EPS);
+}
+
+TEST(StreamTableUnit, FlowsheetTableRunMatchesObjectRun) {
+    streamcounter = 0;
+    auto f1 = std::make_shared<Stream>(++streamcounter);
+    auto f2 = std::make_shared<Stream>(++streamcounter);
+    auto m  = std::make_shared<Stream>(++streamcounter);
+    auto p1 = std::make_shared<Stream>(++streamcounter);
+    auto p2 = std::make_shared<Stream>(++streamcounter);
+    f1->setMassFlow(3.0);
+    f2->setMassFlow(9.0);
+    auto mx = std::make_shared<Mixer>(2);
+    auto rx = std::make_shared<Reactor>(true);
+    mx->addInput(f1); mx->addInput(f2); mx->addOutput(m);
+    rx->addInput(m); rx->addOutput(p1); rx->addOutput(p2);
+
+    Flowsheet fs;
+    fs.addDevice(mx);
+    fs.addDevice(rx);
+
+    StreamTable t;
+    fs.loadTable(t);
+    fs.runTable(t);
+    EXPECT_NEAR(t.getMassFlow(fs.streamId(p2.get())), 6.0, EPS);
+    EXPECT_NEAR(p2->getMassFlow(), 0.0, EPS);           // объекты не тронуты до storeTable
+    EXPECT_EQ(t.getName(fs.streamId(m.get())), "s3");
+
+    fs.storeTable(t);
+    EXPECT_NEAR(p1->getMassFlow(), 6.0, EPS);
+    EXPECT_NEAR(m->getMassFlow(), 12.0, EPS);
+}
+
+// ---------- MixerBatch ----------
+TEST(MixerBatchKernel, MatchesUpdateOutputsOnMixerChain) {
+    streamcounter = 0;
+    Flowsheet fs;
+    std::vector<std::shared_ptr<Stream>> feeds;
+    for (int i = 0; i < 7; i++) {
+        feeds.push_back(std::make_shared<Stream>(++streamcounter));
+        feeds.back()->setMassFlow(1.0 + i);             // 1 + 2 + ... + 7 = 28
+    }
+    auto wide = std::make_shared<Mixer>(7);
+    for (auto& f : feeds) wide->addInput(f);
+    auto mid = std::make_shared<Stream>(++streamcounter);
+    wide->addOutput(mid);
+
+    auto extra = std::make_shared<Stream>(++streamcounter);
+    extra->setMassFlow(2.0);
+    auto last = std::make_shared<Mixer>(2);
+    auto out = std::make_shared<Stream>(++streamcounter);
+    last->addInput(mid); last->addInput(extra); last->addOutput(out);
+
+    fs.addDevice(last);
+    fs.addDevice(wide);
+
+    StreamTable t;
+    fs.loadTable(t);
+    MixerBatch batch;
+    batch.build(fs);
+    ASSERT_EQ(batch.size(), 2u);
+    batch.evaluate(t.data());
+
+    fs.run();
+    EXPECT_NEAR(t.getMassFlow(fs.streamId(mid.get())), 28.0, EPS);
+    EXPECT_NEAR(t.getMassFlow(fs.streamId(out.get())), out->getMassFlow(), EPS);
+    EXPECT_NEAR(out->getMassFlow(), 30.0, EPS);
+}
+
+TEST(MixerBatchKernel, MixerWithoutOutputsIsRejected) {
+    StreamTable t;
+    StreamId in[] = {t.add("a"), t.add("b")};
+    MixerBatch batch;
+    EXPECT_THROW(batch.add({in, in + 2}, {}), std::string);
+}
+
+TEST(MixerBatchKernel, OtherDevicesAreRejected) {
+    Flowsheet fs;
+    Mixer& mx = fs.newMixer(1);
+    StreamId m = fs.newStream();
+    fs.connectInput(mx, fs.newStream(1.0)); fs.connectOutput(mx, m);
+    Reactor& rx = fs.newReactor(false);
+    fs.connectInput(rx, m); fs.connectOutput(rx, fs.newStream());
+    MixerBatch batch;
+    EXPECT_THROW(batch.build(fs), std::string);
+    EXPECT_EQ(batch.size(), 0u);
+}
+
+// ---------- Recycle solver ----------
+// feed -> Mixer -> mixed -> Reactor(2) -> product, recycle -> Mixer
+// Баланс: mixed = feed + mixed/2  =>  mixed = 2*feed, product = recycle = feed.
+struct RecycleLoop {
+    std::shared_ptr<Stream> feed = std::make_shared<Stream>(1);
+    std::shared_ptr<Stream> mixed = std::make_shared<Stream>(2);
+    std::shared_ptr<Stream> product = std::make_shared<Stream>(3);
+    std::shared_ptr<Stream> recycle = std::make_shared<Stream>(4);
+    Flowsheet fs;
+
+    RecycleLoop() {
+        auto mx = std::make_shared<Mixer>(2);
+        auto rx = std::make_shared<Reactor>(true);
+        mx->addInput(feed); mx->addInput(recycle); mx->addOutput(mixed);
+        rx->addInput(mixed); rx->addOutput(product); rx->addOutput(recycle);
+        fs.addDevice(mx);
+        fs.addDevice(rx);
+        feed->setMassFlow(10.0);
+    }
+};
+
+TEST(RecycleSolver, SelectsSingleTearStream) {
+    RecycleLoop loop;
+    auto tears = loop.fs.tearStreams();
+    ASSERT_EQ(tears.size(), 1u);
+    EXPECT_EQ(tears[0], loop.recycle.get());
+}
+
+TEST(RecycleSolver, AllMethodsConvergeToMassBalance) {
+    for (auto method : {RecycleMethod::DirectSubstitution, RecycleMethod::Wegstein, RecycleMethod::Anderson}) {
+        RecycleLoop loop;
+        RecycleOptions opt;
+        opt.method = method;
+        auto report = loop.fs.solve(opt);
+        EXPECT_TRUE(report.converged);
+        EXPECT_EQ(report.loops, 1);
+        EXPECT_NEAR(loop.mixed->getMassFlow(), 20.0, 1e-6);
+        EXPECT_NEAR(loop.product->getMassFlow(), 10.0, 1e-6);
+    }
+}
+
+TEST(RecycleSolver, AccelerationNeedsFewerIterations) {
+    RecycleOptions direct, wegstein, anderson;
+    direct.method = RecycleMethod::DirectSubstitution;
+    anderson.method = RecycleMethod::Anderson;
+    RecycleLoop a, b, c;
+    int nDirect = a.fs.solve(direct).iterations;
+    EXPECT_LT(b.fs.solve(wegstein).iterations, nDirect / 4);
+    EXPECT_LT(c.fs.solve(anderson).iterations, nDirect / 4);
+}
+
+TEST(RecycleSolver, AndersonUsesNewestDifferenceImmediately) {
+    RecycleOptions anderson;
+    anderson.method = RecycleMethod::Anderson;
+    RecycleLoop loop;                                       // линейный рецикл: секущая точна со второй итерации
+    EXPECT_EQ(loop.fs.solve(anderson).iterations, 3);
+
+    RecycleOptions wegstein;
+    for (uint64_t seed = 1; seed <= 3; seed++) {
+        GeneratorOptions opt;
+        opt.devices = 500;
+        opt.recycleDensity = 0.5;
+        opt.seed = seed;
+        Flowsheet a, w;
+        FlowsheetGenerator(opt).generate(a);
+        FlowsheetGenerator(opt).generate(w);
+        const RecycleReport ra = a.solve(anderson), rw = w.solve(wegstein);
+        EXPECT_TRUE(ra.converged);
+        EXPECT_LE(ra.iterations, rw.iterations) << "seed " << seed;
+    }
+}
+
+TEST(RecycleSolver, IterationLimitReportsNotConverged) {
+    RecycleLoop loop;
+    RecycleOptions opt;
+    opt.method = RecycleMethod::DirectSubstitution;
+    opt.maxIterations = 3;
+    auto report = loop.fs.solve(opt);
+    EXPECT_FALSE(report.converged);
+    EXPECT_EQ(report.iterations, 3);
+}
+
+TEST(RecycleSolver, AcyclicFlowsheetSolvesLikeRun) {
+    auto in = std::make_shared<Stream>(1);
+    auto o1 = std::make_shared<Stream>(2);
+    auto o2 = std::make_shared<Stream>(3);
+    in->setMassFlow(8.0);
+    auto rx = std::make_shared<Reactor>(true);
+    rx->addInput(in); rx->addOutput(o1); rx->addOutput(o2);
+    Flowsheet fs;
+    fs.addDevice(rx);
+    auto report = fs.solve();
+    EXPECT_EQ(report.loops, 0);
+    EXPECT_NEAR(o1->getMassFlow(), 4.0, EPS);
+}
+
+// ---------- Linear (equation-oriented) mode ----------
+TEST(LinearSolver, RecycleLoopSolvedDirectly) {
+    RecycleLoop loop;
+    LinearFlowsheetSolver lin;
+    lin.analyze(loop.fs);
+    lin.solve();
+    EXPECT_NEAR(loop.mixed->getMassFlow(), 20.0, 1e-9);
+    EXPECT_NEAR(loop.recycle->getMassFlow(), 10.0, 1e-9);
+    EXPECT_NEAR(loop.product->getMassFlow(), 10.0, 1e-9);
+}
+
+TEST(LinearSolver, FactorizationReusedForNewFeeds) {
+    RecycleLoop loop;
+    LinearFlowsheetSolver lin;
+    lin.analyze(loop.fs);
+    for (double feed : {1.0, 4.0, 7.5}) {
+        loop.feed->setMassFlow(feed);
+        lin.solve();
+        EXPECT_NEAR(loop.product->getMassFlow(), feed, 1e-9);
+    }
+    EXPECT_EQ(lin.factorizationCount(), 1);
+}
+
+TEST(LinearSolver, ClosedLoopWithoutOutletIsSingular) {
+    auto a = std::make_shared<Stream>(1);
+    auto b = std::make_shared<Stream>(2);
+    auto r1 = std::make_shared<Reactor>(false);
+    auto r2 = std::make_shared<Reactor>(false);
+    r1->addInput(a); r1->addOutput(b);
+    r2->addInput(b); r2->addOutput(a);
+    Flowsheet fs;
+    fs.addDevice(r1);
+    fs.addDevice(r2);
+    LinearFlowsheetSolver lin;
+    EXPECT_THROW(lin.analyze(fs), std::string);
+}
+
+TEST(LinearSolver, IncompletePortsAndSharedOutputsAreRejected) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(4.0), half = fs.newStream();
+    Reactor& rx = fs.newReactor(true);                  // второй выход не подключён
+    fs.connectInput(rx, feed); fs.connectOutput(rx, half);
+    LinearFlowsheetSolver lin;
+    EXPECT_THROW(lin.analyze(fs), std::string);
+
+    Flowsheet dup;
+    StreamId a = dup.newStream(1.0), b = dup.newStream(2.0), out = dup.newStream();
+    Reactor& r1 = dup.newReactor(false);
+    dup.connectInput(r1, a); dup.connectOutput(r1, out);
+    Reactor& r2 = dup.newReactor(false);
+    dup.connectInput(r2, b); dup.connectOutput(r2, out);
+    EXPECT_THROW(lin.analyze(dup), std::string);
+}
+
+TEST(LinearSolver, SparseLUMatchesDenseSolve) {
+    // [ 4 -1  0 ]       [ 3 ]
+    // [-1  4 -1 ] x  =  [ 2 ]   =>  x = (1, 1, 1)
+    // [ 0 -2  4 ]       [ 2 ]
+    std::vector<size_t> ptr = {0, 2, 5, 7};
+    std::vector<uint32_t> col = {0, 1, 0, 1, 2, 1, 2};
+    std::vector<double> val = {4, -1, -1, 4, -1, -2, 4};
+    SparseLU lu;
+    lu.analyze(3, ptr, col);
+    lu.factorize(val);
+    double b[] = {3, 2, 2};
+    lu.solve(b);
+    EXPECT_NEAR(b[0], 1.0, 1e-12);
+    EXPECT_NEAR(b[1], 1.0, 1e-12);
+    EXPECT_NEAR(b[2], 1.0, 1e-12);
+}
+
+// ---------- Incremental update ----------
+TEST(StreamUnit, SetMassFlowBumpsVersion) {
+    Stream s(1);
+    auto v0 = s.getVersion();
+    s.setMassFlow(1.0);
+    s.setMassFlow(1.0);
+    EXPECT_EQ(s.getVersion(), v0 + 2);
+}
+
+// Две независимые ветки: feedA -> rA -> midA -> mA -> outA, feedB -> rB -> outB.
+TEST(FlowsheetIncremental, OnlyDownstreamOfChangedFeedIsEvaluated) {
+    auto feedA = std::make_shared<Stream>(1), midA = std::make_shared<Stream>(2);
+    auto outA  = std::make_shared<Stream>(3);
+    auto feedB = std::make_shared<Stream>(4), outB = std::make_shared<Stream>(5);
+    auto rA = std::make_shared<Reactor>(false);
+    auto mA = std::make_shared<Mixer>(1);
+    auto rB = std::make_shared<Reactor>(false);
+    rA->addInput(feedA); rA->addOutput(midA);
+    mA->addInput(midA);  mA->addOutput(outA);
+    rB->addInput(feedB); rB->addOutput(outB);
+    feedA->setMassFlow(1.0);
+    feedB->setMassFlow(2.0);
+
+    Flowsheet fs;
+    fs.addDevice(rA); fs.addDevice(mA); fs.addDevice(rB);
+    EXPECT_EQ(fs.update(), 3u);                         // первый проход — всё
+    EXPECT_EQ(fs.update(), 0u);                         // ничего не менялось
+
+    feedB->setMassFlow(5.0);
+    EXPECT_EQ(fs.update(), 1u);                         // только rB
+    EXPECT_NEAR(outB->getMassFlow(), 5.0, EPS);
+
+    feedA->setMassFlow(3.0);
+    EXPECT_EQ(fs.update(), 2u);                         // rA и mA
+    EXPECT_NEAR(outA->getMassFlow(), 3.0, EPS);
+}
+
+TEST(FlowsheetIncremental, BitIdenticalInputsAreSkipped) {
+    auto feed = std::make_shared<Stream>(1), out = std::make_shared<Stream>(2);
+    auto rx = std::make_shared<Reactor>(false);
+    rx->addInput(feed); rx->addOutput(out);
+    feed->setMassFlow(4.0);
+
+    Flowsheet fs;
+    fs.addDevice(rx);
+    fs.update();
+    feed->setMassFlow(4.0);                             // версия выросла, значение то же
+    EXPECT_EQ(fs.update(), 0u);
+}
+
+// ---------- Typed schedule ----------
+// Наследник Mixer не должен попадать в статическую корзину миксеров.
+class DoublingMixer : public Mixer {
+public:
+    DoublingMixer(): Mixer(1) {}
+    void updateOutputs() override {
+        outputs.at(0)->setMassFlow(2.0 * inputs.at(0)->getMassFlow());
+    }
+    void updateTable(double* flows, const StreamId* in, size_t, const StreamId* out, size_t) const override {
+        flows[out[0]] = 2.0 * flows[in[0]];
+    }
+};
+
+TEST(TypedScheduleDispatch, LevelsAndResultsMatchVirtualRun) {
+    streamcounter = 0;
+    auto f1 = std::make_shared<Stream>(++streamcounter), f2 = std::make_shared<Stream>(++streamcounter);
+    auto a = std::make_shared<Stream>(++streamcounter), b = std::make_shared<Stream>(++streamcounter);
+    auto c = std::make_shared<Stream>(++streamcounter), d = std::make_shared<Stream>(++streamcounter);
+    auto e = std::make_shared<Stream>(++streamcounter);
+    f1->setMassFlow(3.0);
+    f2->setMassFlow(4.0);
+
+    auto r1 = std::make_shared<Reactor>(false);         // уровень 0
+    auto dm = std::make_shared<DoublingMixer>();        // уровень 0
+    auto mx = std::make_shared<Mixer>(2);               // уровень 1
+    auto r2 = std::make_shared<Reactor>(true);          // уровень 2
+    r1->addInput(f1); r1->addOutput(a);
+    dm->addInput(f2); dm->addOutput(b);
+    mx->addInput(a); mx->addInput(b); mx->addOutput(c);
+    r2->addInput(c); r2->addOutput(d); r2->addOutput(e);
+
+    Flowsheet fs;
+    fs.addDevice(r2); fs.addDevice(mx); fs.addDevice(dm); fs.addDevice(r1);
+    auto lv = fs.levels();
+    ASSERT_EQ(lv.size(), 3u);
+    EXPECT_EQ(lv[0].size(), 2u);
+
+    TypedSchedule ts;
+    ts.build(fs);
+    EXPECT_EQ(ts.levelCount(), 3u);
+
+    StreamTable t;
+    fs.loadTable(t);
+    ts.runTable(fs, t.data());
+    ts.run();
+    EXPECT_NEAR(c->getMassFlow(), 11.0, EPS);           // 3 + 2*4
+    EXPECT_NEAR(e->getMassFlow(), 5.5, EPS);
+    EXPECT_NEAR(t.getMassFlow(fs.streamId(e.get())), 5.5, EPS);
+}
+
+// ---------- Pooled ownership ----------
+TEST(ObjectPoolUnit, AddressesStableAndObjectsDestroyed) {
+    static int alive = 0;
+    struct Counted { Counted() { alive++; } ~Counted() { alive--; } };
+    {
+        ObjectPool<Counted, 4> pool;
+        Counted* first = &pool.emplace();
+        for (int i = 0; i < 9; i++) pool.emplace();
+        EXPECT_EQ(pool.size(), 10u);
+        EXPECT_EQ(&pool[0], first);
+        EXPECT_EQ(alive, 10);
+    }
+    EXPECT_EQ(alive, 0);
+}
+
+TEST(FlowsheetArena, PooledChainRunsAndOutlivesFlowsheet) {
+    std::shared_ptr<Stream> tail;
+    {
+        Flowsheet fs;
+        const int n = 5000;
+        fs.reserve(n + 1, n);
+        StreamId prev = fs.newStream(64.0);
+        for (int i = 0; i < n; i++) {
+            Reactor& r = fs.newReactor(false);
+            StreamId next = fs.newStream();
+            fs.connectInput(r, prev);
+            fs.connectOutput(r, next);
+            prev = next;
+        }
+        fs.run();
+        EXPECT_EQ(fs.streamId(&fs.stream(prev)), prev);
+        EXPECT_NEAR(fs.stream(prev).getMassFlow(), 64.0, EPS);
+        tail = fs.getStreams().back();
+    }
+    EXPECT_NEAR(tail->getMassFlow(), 64.0, EPS);         // пул жив, пока есть указатель
+}
+
+TEST(FlowsheetArena, ConnectThroughDeviceUsesMixerLimits) {
+    Flowsheet fs;
+    Mixer& m = fs.newMixer(1);
+    StreamId a = fs.newStream(1.0), b = fs.newStream(2.0);
+    fs.connectInput(m, a);
+    EXPECT_THROW(fs.connectInput(m, b), std::string);    // "Too much inputs" через Device&
+}
+
+// ---------- Port views ----------
+TEST(DeviceAPI, ViewsReferToPortsWithoutCopying) {
+    streamcounter = 0;
+    Mixer mx(2);
+    auto s1 = std::make_shared<Stream>(++streamcounter);
+    auto s2 = std::make_shared<Stream>(++streamcounter);
+    auto o  = std::make_shared<Stream>(++streamcounter);
+    mx.addInput(s1); mx.addInput(s2); mx.addOutput(o);
+
+    auto ins = mx.inputsView();
+    ASSERT_EQ(ins.size(), 2u);
+    EXPECT_EQ(ins[1], s2.get());
+    EXPECT_EQ(s1.use_count(), 2);                       // представление не увеличивает счётчик
+    EXPECT_EQ(mx.inputsView().data(), ins.data());
+    EXPECT_EQ(mx.outputsView()[0]->getName(), "s3");
+}
+
+TEST(FlowsheetSchedule, PrintListsPortsAndFlows) {
+    Flowsheet fs;
+    Reactor& r = fs.newReactor(false);
+    fs.connectInput(r, fs.newStream(2.5));
+    fs.connectOutput(r, fs.newStream());
+    fs.run();
+    std::ostringstream oss;
+    fs.print(oss);
+    EXPECT_NE(oss.str().find("Device 0: s1 -> s2"), std::string::npos);
+    EXPECT_NE(oss.str().find("Stream s2 flow = 2.5"), std::string::npos);
+}
+
+// ---------- Multi-component streams ----------
+TEST(StreamComponents, TotalIsSumAndStorageIsAligned) {
+    Stream s(1);
+    s.setComponentFlows({1.0, 2.0, 3.0, 4.0, 5.0});
+    EXPECT_EQ(s.componentCount(), 5u);
+    EXPECT_NEAR(s.getMassFlow(), 15.0, EPS);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(s.componentData()) % COMPONENT_ALIGNMENT, 0u);
+}
+
+TEST(StreamComponents, MixerSumsAndReactorSplitsComponentWise) {
+    auto a = std::make_shared<Stream>(1), b = std::make_shared<Stream>(2);
+    auto m = std::make_shared<Stream>(3), p1 = std::make_shared<Stream>(4), p2 = std::make_shared<Stream>(5);
+    std::vector<double> ca(21), cb(21);
+    for (int i = 0; i < 21; i++) { ca[i] = i; cb[i] = 2.0 * i; }
+    a->setComponentFlows(ca);
+    b->setComponentFlows(cb);
+
+    Mixer mx(2);
+    mx.addInput(a); mx.addInput(b); mx.addOutput(m);
+    Reactor rx(true);
+    rx.addInput(m); rx.addOutput(p1); rx.addOutput(p2);
+    mx.updateOutputs();
+    rx.updateOutputs();
+
+    ASSERT_EQ(p2->componentCount(), 21u);
+    for (int i = 0; i < 21; i++) {
+        EXPECT_NEAR(m->getComponentFlow(i), 3.0 * i, 1e-12);
+        EXPECT_NEAR(p2->getComponentFlow(i), 1.5 * i, 1e-12);
+    }
+    EXPECT_NEAR(m->getMassFlow(), 630.0, EPS);          // 3 * (0 + ... + 20)
+}
+
+TEST(StreamComponents, MismatchedComponentCountsThrow) {
+    auto a = std::make_shared<Stream>(1), b = std::make_shared<Stream>(2), o = std::make_shared<Stream>(3);
+    a->setComponentFlows({1.0, 2.0});
+    b->setComponentFlows({1.0, 2.0, 3.0});
+    Mixer mx(2);
+    mx.addInput(a); mx.addInput(b); mx.addOutput(o);
+    EXPECT_THROW(mx.updateOutputs(), std::string);
+}
+
+TEST(StreamComponents, SetMassFlowRescalesComposition) {
+    Stream s(1);
+    s.setComponentFlows({1.0, 3.0});
+    s.setMassFlow(8.0);
+    EXPECT_DOUBLE_EQ(s.getComponentFlow(0), 2.0);
+    EXPECT_DOUBLE_EQ(s.getComponentFlow(1), 6.0);
+
+    s.setComponentFlows({0.0, 0.0});
+    EXPECT_NO_THROW(s.setMassFlow(0.0));
+    EXPECT_THROW(s.setMassFlow(1.0), std::string);          // пустой состав не масштабируется
+}
+
+TEST(StreamComponents, UpdateSeesCompositionOnlyChange) {
+    Flowsheet fs;
+    StreamId a = fs.newStream(), b = fs.newStream(), out = fs.newStream();
+    fs.stream(a).setComponentFlows({1.0, 0.0});
+    fs.stream(b).setComponentFlows({0.0, 1.0});
+    Mixer& mixer = fs.newMixer(2);
+    fs.connectInput(mixer, a); fs.connectInput(mixer, b); fs.connectOutput(mixer, out);
+    fs.update();
+
+    fs.stream(a).setComponentFlows({0.0, 1.0});             // суммарный расход тот же
+    EXPECT_EQ(fs.update(), 1u);
+    EXPECT_DOUBLE_EQ(fs.stream(out).getComponentFlow(0), 0.0);
+    EXPECT_DOUBLE_EQ(fs.stream(out).getComponentFlow(1), 2.0);
+}
+
+TEST(StreamComponents, RecycleSolveConvergesCompositions) {
+    // feed -> Mixer -> Reactor(2, A -> B на 50 %) -> product, recycle -> Mixer.
+    // Баланс по A: mixed_A = 10 + mixed_A/4 => 40/3; по B: mixed_B = mixed_A/4 + mixed_B/2 => 20/3.
+    for (auto method : {RecycleMethod::DirectSubstitution, RecycleMethod::Wegstein, RecycleMethod::Anderson}) {
+        RecycleLoop loop;
+        loop.feed->setComponentFlows({10.0, 0.0});
+        loop.recycle->setComponentFlows({0.0, 0.0});         // у входов миксера один набор компонентов
+        auto rx = std::dynamic_pointer_cast<Reactor>(loop.fs.getDevices()[1]);
+        rx->setReactions(2, {-1.0, 1.0}, {0}, {0.5});
+        RecycleOptions opt;
+        opt.method = method;
+        EXPECT_TRUE(loop.fs.solve(opt).converged);
+        EXPECT_NEAR(loop.mixed->getComponentFlow(0), 40.0 / 3, 1e-6);
+        EXPECT_NEAR(loop.mixed->getComponentFlow(1), 20.0 / 3, 1e-6);
+        EXPECT_NEAR(loop.product->getComponentFlow(0), 10.0 / 3, 1e-6);
+        EXPECT_NEAR(loop.product->getComponentFlow(1), 20.0 / 3, 1e-6);
+        for (Stream* s : {loop.mixed.get(), loop.product.get(), loop.recycle.get()})
+            EXPECT_NEAR(s->getComponentFlow(0) + s->getComponentFlow(1), s->getMassFlow(), 1e-12);
+    }
+}
+
+// ---------- Reactor stoichiometry ----------
+TEST(ReactorReactions, ConversionOfKeyComponent) {
+    // A -> B (массовые коэффициенты -1, +1), конверсия A 40 %.
+    auto in = std::make_shared<Stream>(1), out = std::make_shared<Stream>(2);
+    in->setComponentFlows({10.0, 0.0, 5.0});
+    Reactor rx(false);
+    rx.setReactions(3, {-1.0, 1.0, 0.0}, {0}, {0.4});
+    rx.addInput(in); rx.addOutput(out);
+    rx.updateOutputs();
+    EXPECT_NEAR(out->getComponentFlow(0), 6.0, 1e-12);
+    EXPECT_NEAR(out->getComponentFlow(1), 4.0, 1e-12);
+    EXPECT_NEAR(out->getComponentFlow(2), 5.0, 1e-12);
+    EXPECT_NEAR(out->getMassFlow(), 15.0, EPS);
+}
+
+TEST(ReactorReactions, SequentialReactionsAndSplitConserveMass) {
+    // A + B -> C (0.5A + 0.5B -> 1C), затем C -> D; реактор с двумя выходами.
+    auto in = std::make_shared<Stream>(1);
+    auto o1 = std::make_shared<Stream>(2), o2 = std::make_shared<Stream>(3);
+    in->setComponentFlows({8.0, 8.0, 0.0, 0.0, 1.0});
+    Reactor rx(true);
+    rx.setReactions(5, {-0.5, -0.5, 1.0, 0.0, 0.0,
+                         0.0,  0.0, -1.0, 1.0, 0.0}, {0, 2}, {1.0, 0.25});
+    rx.addInput(in); rx.addOutput(o1); rx.addOutput(o2);
+    rx.updateOutputs();
+    // Реакция 1: полнота 16 -> A=0, B=0, C=16; реакция 2: C -> D на 4.
+    EXPECT_NEAR(o1->getComponentFlow(2), 6.0, 1e-12);
+    EXPECT_NEAR(o2->getComponentFlow(3), 2.0, 1e-12);
+    double total = 0.0;
+    for (size_t c = 0; c < 5; c++) total += o1->getComponentFlow(c) + o2->getComponentFlow(c);
+    EXPECT_NEAR(total, in->getMassFlow(), 1e-12);
+}
+
+TEST(ReactorReactions, FixedExtent) {
+    auto in = std::make_shared<Stream>(1), out = std::make_shared<Stream>(2);
+    in->setComponentFlows({3.0, 1.0});
+    Reactor rx(false);
+    rx.setExtents(2, {-1.0, 1.0}, {2.0});
+    rx.addInput(in); rx.addOutput(out);
+    rx.updateOutputs();
+    EXPECT_NEAR(out->getComponentFlow(0), 1.0, 1e-12);
+    EXPECT_NEAR(out->getComponentFlow(1), 3.0, 1e-12);
+}
+
+TEST(ReactorReactions, InvalidExtentsAreRejected) {
+    Reactor rx(false);
+    EXPECT_THROW(rx.setExtents(2, {-1.0, 1.0}, {-0.5}), std::string);
+    EXPECT_THROW(rx.setExtents(2, {-1.0, 1.0}, {std::nan("")}), std::string);
+    EXPECT_THROW(rx.setExtents(2, {-1.0, 1.0}, {INFINITY}), std::string);
+
+    auto in = std::make_shared<Stream>(1), out = std::make_shared<Stream>(2);
+    in->setComponentFlows({1.0, 1.0});
+    rx.setExtents(2, {-1.0, 1.0}, {1.5});                  // расходуется больше, чем подано
+    rx.addInput(in); rx.addOutput(out);
+    EXPECT_THROW(rx.updateOutputs(), std::string);
+    rx.setExtents(2, {-1.0, 1.0}, {1.0});                  // ровно всё сырьё
+    rx.updateOutputs();
+    EXPECT_NEAR(out->getComponentFlow(0), 0.0, 1e-12);
+    EXPECT_NEAR(out->getMassFlow(), 2.0, 1e-12);
+}
+
+TEST(ReactorReactions, InvalidReactionsAreRejected) {
+    Reactor rx(false);
+    EXPECT_THROW(rx.setReactions(2, {-1.0, 0.5}, {0}, {0.5}), std::string);   // масса не сохраняется
+    EXPECT_THROW(rx.setReactions(2, {1.0, -1.0}, {0}, {0.5}), std::string);   // ключ не расходуется
+    EXPECT_THROW(rx.setReactions(2, {-1.0, 1.0}, {0}, {1.5}), std::string);   // конверсия > 1
+    EXPECT_THROW(rx.setReactions(3, {-1.0, 1.0}, {0}, {0.5}), std::string);   // размеры
+}
+
+// ---------- Parallel executor ----------
+// Широкая схема: width независимых цепочек feed -> Reactor(2) -> Mixer(2) -> Reactor(1).
+static void buildWideFlowsheet(Flowsheet& fs, int width) {
+    for (int i = 0; i < width; i++) {
+        StreamId feed = fs.newStream(1.0 + 0.1 * i);
+        StreamId a = fs.newStream(), b = fs.newStream(), m = fs.newStream(), out = fs.newStream();
+        Reactor& split = fs.newReactor(true);
+        fs.connectInput(split, feed); fs.connectOutput(split, a); fs.connectOutput(split, b);
+        Mixer& mix = fs.newMixer(2);
+        fs.connectInput(mix, a); fs.connectInput(mix, b); fs.connectOutput(mix, m);
+        Reactor& tail = fs.newReactor(false);
+        fs.connectInput(tail, m); fs.connectOutput(tail, out);
+    }
+}
+
+TEST(ParallelExecution, MatchesSerialRunBitwise) {
+    Flowsheet serial, parallel;
+    buildWideFlowsheet(serial, 3000);
+    buildWideFlowsheet(parallel, 3000);
+    serial.run();
+
+    ParallelExecutor exec(4, 32);
+    exec.build(parallel);
+    exec.run();
+
+    ASSERT_EQ(serial.getStreams().size(), parallel.getStreams().size());
+    for (size_t i = 0; i < serial.getStreams().size(); i++) {
+        ASSERT_EQ(serial.getStreams()[i]->getMassFlow(), parallel.getStreams()[i]->getMassFlow());
+    }
+}
+
+TEST(ParallelExecution, PoolCoversRangeAndPropagatesExceptions) {
+    WorkStealingPool pool(3);
+    std::vector<std::atomic<int>> hits(1000);
+    pool.parallelFor(hits.size(), 7, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; i++) hits[i]++;
+    });
+    for (auto& h : hits) ASSERT_EQ(h.load(), 1);
+
+    EXPECT_THROW(pool.parallelFor(100, 10, [](size_t b, size_t) {
+        if (b == 50) throw std::string("boom");
+    }), std::string);
+}
+
+// ---------- Scenario lanes ----------
+TEST(ScenarioLanes, EachLaneMatchesSeparateRun) {
+    // Две подачи -> Mixer -> Reactor(2) -> один выход в Mixer с третьей подачей.
+    Flowsheet fs;
+    StreamId f1 = fs.newStream(), f2 = fs.newStream(), f3 = fs.newStream();
+    StreamId m = fs.newStream(), a = fs.newStream(), b = fs.newStream(), out = fs.newStream();
+    Mixer& mx = fs.newMixer(2);
+    fs.connectInput(mx, f1); fs.connectInput(mx, f2); fs.connectOutput(mx, m);
+    Reactor& rx = fs.newReactor(true);
+    fs.connectInput(rx, m); fs.connectOutput(rx, a); fs.connectOutput(rx, b);
+    Mixer& tail = fs.newMixer(2);
+    fs.connectInput(tail, b); fs.connectInput(tail, f3); fs.connectOutput(tail, out);
+
+    ScenarioBatch<8> batch;
+    batch.build(fs);
+    for (size_t l = 0; l < 8; l++) {
+        batch.setMassFlow(f1, l, 1.0 + l);
+        batch.setMassFlow(f2, l, 2.0 * l);
+        batch.setMassFlow(f3, l, 0.5);
+    }
+    batch.evaluate();
+
+    for (size_t l = 0; l < 8; l++) {
+        fs.stream(f1).setMassFlow(1.0 + l);
+        fs.stream(f2).setMassFlow(2.0 * l);
+        fs.stream(f3).setMassFlow(0.5);
+        fs.run();
+        EXPECT_DOUBLE_EQ(batch.getMassFlow(out, l), fs.stream(out).getMassFlow());
+        EXPECT_DOUBLE_EQ(batch.getMassFlow(a, l), fs.stream(a).getMassFlow());
+    }
+}
+
+TEST(ScenarioLanes, LanesAreAlignedForVectorLoads) {
+    Flowsheet fs;
+    Reactor& rx = fs.newReactor(false);
+    fs.connectInput(rx, fs.newStream(3.0));
+    fs.connectOutput(rx, fs.newStream());
+    ScenarioBatch<16> batch;
+    batch.build(fs);
+    batch.evaluate();
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(batch.lanesOf(1)) % 64, 0u);
+    EXPECT_DOUBLE_EQ(batch.getMassFlow(1, 15), 3.0);
+}
+
+// ---------- Monte Carlo ----------
+TEST(MonteCarloUnit, PhiloxKnownAnswer) {
+    // Контрольный вектор Random123 для philox4x32-10 с нулевыми счётчиком и ключом.
+    auto r = Philox4x32::generate({0, 0, 0, 0}, {0, 0});
+    EXPECT_EQ(r[0], 0x6627e8d5u);
+    EXPECT_EQ(r[1], 0xe169c58du);
+    EXPECT_EQ(r[2], 0xbc57ac4cu);
+    EXPECT_EQ(r[3], 0x9b00dbd8u);
+}
+
+TEST(MonteCarloUnit, P2QuantileTracksUniformMedian) {
+    P2Quantile median(0.5), upper(0.9);
+    for (int i = 0; i < 10001; i++) {
+        double x = (i * 7919 % 10001) / 10000.0;        // перестановка 0..1
+        median.add(x);
+        upper.add(x);
+    }
+    EXPECT_NEAR(median.value(), 0.5, 0.01);
+    EXPECT_NEAR(upper.value(), 0.9, 0.01);
+}
+
+// feedA ~ U(0, 2), feedB ~ N(3, 0.5) -> Mixer -> Reactor(2): выход = (A + B) / 2.
+struct UncertainFlowsheet {
+    Flowsheet fs;
+    StreamId a, b, out;
+    UncertainFlowsheet() {
+        a = fs.newStream(); b = fs.newStream();
+        StreamId m = fs.newStream(), other = fs.newStream();
+        out = fs.newStream();
+        Mixer& mx = fs.newMixer(2);
+        fs.connectInput(mx, a); fs.connectInput(mx, b); fs.connectOutput(mx, m);
+        Reactor& rx = fs.newReactor(true);
+        fs.connectInput(rx, m); fs.connectOutput(rx, out); fs.connectOutput(rx, other);
+    }
+};
+
+static std::vector<OutputSummary> runUncertain(size_t threads) {
+    UncertainFlowsheet u;
+    MonteCarlo mc(u.fs);
+    mc.addFeed(u.a, {FeedDistribution::Uniform, 0.0, 2.0});
+    mc.addFeed(u.b, {FeedDistribution::Normal, 3.0, 0.5});
+    mc.watch(u.out);
+    MonteCarloOptions opt;
+    opt.samples = 20003;                                // не кратно ширине пачки
+    opt.seed = 42;
+    opt.threads = threads;
+    return mc.run(opt);
+}
+
+TEST(MonteCarloUnit, MomentsMatchAnalyticValues) {
+    auto s = runUncertain(2);
+    ASSERT_EQ(s.size(), 1u);
+    EXPECT_EQ(s[0].stats.count(), 20003u);
+    EXPECT_NEAR(s[0].stats.mean(), 2.0, 0.02);          // (1 + 3) / 2
+    // Var = (Var U + Var N) / 4 = (1/3 + 1/4) / 4
+    EXPECT_NEAR(s[0].stats.variance(), (1.0/3 + 0.25) / 4, 0.005);
+    EXPECT_NEAR(s[0].quantiles[1].value(), 2.0, 0.02);
+}
+
+TEST(MonteCarloUnit, ResultsDoNotDependOnThreadCount) {
+    auto one = runUncertain(1), four = runUncertain(4);
+    EXPECT_EQ(one[0].stats.mean(), four[0].stats.mean());
+    EXPECT_EQ(one[0].stats.variance(), four[0].stats.variance());
+    for (size_t q = 0; q < one[0].quantiles.size(); q++)
+        EXPECT_EQ(one[0].quantiles[q].value(), four[0].quantiles[q].value());
+}
+
+// ---------- Flowsheet generator ----------
+static double sumFlows(Flowsheet& fs, const std::vector<StreamId>& ids) {
+    double sum = 0.0;
+    for (StreamId id : ids) sum += fs.stream(id).getMassFlow();
+    return sum;
+}
+
+TEST(FlowsheetGeneratorUnit, SameSeedGivesSameFlowsheet) {
+    GeneratorOptions opt;
+    opt.devices = 300;
+    opt.seed = 7;
+    Flowsheet a, b, c;
+    auto ia = FlowsheetGenerator(opt).generate(a);
+    auto ib = FlowsheetGenerator(opt).generate(b);
+    opt.seed = 8;
+    auto ic = FlowsheetGenerator(opt).generate(c);
+
+    ASSERT_EQ(a.getStreams().size(), b.getStreams().size());
+    EXPECT_EQ(ia.feeds, ib.feeds);
+    EXPECT_EQ(ia.products, ib.products);
+    a.run(); b.run(); c.run();
+    for (size_t i = 0; i < a.getStreams().size(); i++)
+        EXPECT_EQ(a.stream(i).getMassFlow(), b.stream(i).getMassFlow());
+    for (size_t d = 0; d < a.getDevices().size(); d++)
+        EXPECT_EQ(typeid(*a.getDevices()[d]), typeid(*b.getDevices()[d]));
+    EXPECT_NE(sumFlows(a, ia.products), sumFlows(c, ic.products));
+}
+
+TEST(FlowsheetGeneratorUnit, AcyclicShapeAndMassBalance) {
+    GeneratorOptions opt;
+    opt.devices = 2000;
+    opt.depth = 25;
+    opt.maxFanIn = 3;
+    Flowsheet fs;
+    auto info = FlowsheetGenerator(opt).generate(fs);
+
+    EXPECT_EQ(fs.getDevices().size(), 2000u);
+    EXPECT_TRUE(info.recycles.empty());
+    EXPECT_EQ(fs.levels().size(), 25u);
+    for (const auto& d : fs.getDevices()) {
+        if (dynamic_cast<Mixer*>(d.get())) {
+            EXPECT_LE(d->inputsView().size(), 3u);
+        }
+    }
+    fs.run();
+    EXPECT_NEAR(sumFlows(fs, info.products), sumFlows(fs, info.feeds), 1e-9 * sumFlows(fs, info.feeds));
+}
+
+TEST(FlowsheetGeneratorUnit, RecyclesConvergeAndConserveMass) {
+    GeneratorOptions opt;
+    opt.devices = 500;
+    opt.recycleDensity = 0.5;
+    opt.seed = 3;
+    Flowsheet fs;
+    auto info = FlowsheetGenerator(opt).generate(fs);
+
+    ASSERT_FALSE(info.recycles.empty());
+    EXPECT_THROW(fs.schedule(), std::string);
+    RecycleOptions ro;
+    ro.method = RecycleMethod::Wegstein;
+    auto report = fs.solve(ro);
+    EXPECT_TRUE(report.converged);
+    EXPECT_GT(report.loops, 0);
+    EXPECT_NEAR(sumFlows(fs, info.products), sumFlows(fs, info.feeds), 1e-6 * sumFlows(fs, info.feeds));
+}
+
+// ---------- Profiling ----------
+TEST(DeviceProfiling, CountsCallsAndTime) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(4.0), mid = fs.newStream(), out = fs.newStream();
+    Mixer& mx = fs.newMixer(1);
+    fs.connectInput(mx, feed); fs.connectOutput(mx, mid);
+    Reactor& rx = fs.newReactor(false);
+    fs.connectInput(rx, mid); fs.connectOutput(rx, out);
+    fs.run();
+    fs.run();
+
+    auto p = fs.profile();
+    ASSERT_EQ(p.size(), 2u);
+    EXPECT_STREQ(p[0].type, "Mixer");
+    EXPECT_STREQ(p[1].type, "Reactor");
+    if (!PROFILING_ENABLED) {
+        EXPECT_EQ(p[0].calls, 0u);
+        return;
+    }
+    EXPECT_EQ(p[0].calls, 2u);
+    EXPECT_EQ(p[1].calls, 2u);
+    EXPECT_EQ(p[1].exceptions, 0u);
+    EXPECT_GT(p[1].totalNs, 0.0);
+    EXPECT_LE(p[1].maxNs, p[1].totalNs);
+    fs.resetProfile();
+    EXPECT_EQ(fs.profile()[0].calls, 0u);
+}
+
+TEST(DeviceProfiling, ExceptionsAreCountedAndRethrown) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(1.0);
+    Mixer& mx = fs.newMixer(1);
+    fs.connectInput(mx, feed);                          // без выхода: updateOutputs бросает
+    EXPECT_THROW(fs.run(), std::string);
+    if (PROFILING_ENABLED) {
+        EXPECT_EQ(fs.profile()[0].calls, 1u);
+        EXPECT_EQ(fs.profile()[0].exceptions, 1u);
+    }
+}
+
+TEST(DeviceProfiling, CsvDumpHasRowPerDevice) {
+    Flowsheet fs;
+    buildWideFlowsheet(fs, 5);
+    fs.run();
+    std::stringstream csv;
+    fs.printProfile(csv, ProfileFormat::Csv);
+    std::string line;
+    std::getline(csv, line);
+    EXPECT_EQ(line, "device,type,calls,exceptions,total_ns,max_ns");
+    size_t rows = 0;
+    while (std::getline(csv, line)) rows++;
+    EXPECT_EQ(rows, fs.getDevices().size());
+
+    std::stringstream text;
+    fs.printProfile(text);
+    EXPECT_NE(text.str().find("Reactor: calls = "), std::string::npos);
+}
+
+// ---------- Tracing ----------
+static size_t countOf(const std::string& text, const std::string& what) {
+    size_t n = 0;
+    for (size_t p = text.find(what); p != std::string::npos; p = text.find(what, p + 1)) n++;
+    return n;
+}
+
+TEST(ChromeTrace, DeviceUpdatesAreNestedInRun) {
+    Flowsheet fs;
+    buildWideFlowsheet(fs, 2);
+    Tracer tracer;
+    fs.labelTrace(tracer);
+    fs.run();                                           // до start — не записывается
+    tracer.start();
+    fs.run();
+    tracer.stop();
+    fs.run();                                           // после stop — не записывается
+
+    EXPECT_EQ(tracer.eventCount(), 2 * (fs.getDevices().size() + 1));
+    std::stringstream json;
+    tracer.exportChromeTrace(json);
+    const std::string text = json.str();
+    EXPECT_EQ(text.rfind("{\"traceEvents\":[", 0), 0u);
+    EXPECT_EQ(countOf(text, "\"ph\":\"B\""), countOf(text, "\"ph\":\"E\""));
+    EXPECT_EQ(countOf(text, "\"name\":\"Flowsheet::run\""), 2u);
+    EXPECT_EQ(countOf(text, "\"name\":\"Mixer 1\""), 2u);
+    EXPECT_LT(text.find("Flowsheet::run"), text.find("Reactor 0"));
+}
+
+TEST(ChromeTrace, RecycleIterationsAreRecorded) {
+    RecycleLoop loop;
+    Tracer tracer;
+    tracer.start();
+    auto report = loop.fs.solve();
+    tracer.stop();
+    std::stringstream json;
+    tracer.exportChromeTrace(json);
+    EXPECT_EQ(countOf(json.str(), "\"name\":\"Recycle iteration\",\"ph\":\"B\""), size_t(report.iterations));
+    EXPECT_EQ(countOf(json.str(), "\"name\":\"Recycle loop\""), 2u);
+}
+
+TEST(ChromeTrace, ParallelRunRecordsEveryDeviceOnWorkerThreads) {
+    Flowsheet fs;
+    buildWideFlowsheet(fs, 200);
+    ParallelExecutor exec(4, 16);
+    exec.build(fs);
+    Tracer tracer;
+    tracer.start();
+    exec.run();
+    tracer.stop();
+    // Участок на каждое устройство, уровень и сам проход.
+    EXPECT_EQ(tracer.eventCount(), 2 * (fs.getDevices().size() + fs.levels().size() + 1));
+    EXPECT_EQ(tracer.droppedCount(), 0u);
+}
+
+TEST(ChromeTrace, RingBufferKeepsNewestEvents) {
+    Flowsheet fs;
+    buildWideFlowsheet(fs, 10);
+    Tracer tracer(8);
+    tracer.start();
+    fs.run();
+    tracer.stop();
+    EXPECT_EQ(tracer.eventCount(), 8u);
+    EXPECT_EQ(tracer.droppedCount(), 2 * (fs.getDevices().size() + 1) - 8);
+    std::stringstream json;
+    tracer.exportChromeTrace(json);
+    EXPECT_NE(json.str().find("\"name\":\"Flowsheet::run\",\"ph\":\"E\""), std::string::npos);
+}
+
+// ---------- Compiled plans ----------
+TEST(FlowsheetPlanUnit, MatchesRunBitwise) {
+    GeneratorOptions opt;
+    opt.devices = 3000;
+    opt.seed = 11;
+    Flowsheet fs;
+    auto info = FlowsheetGenerator(opt).generate(fs);
+    FlowsheetPlan plan;
+    ASSERT_TRUE(plan.compile(fs).empty());
+    ASSERT_TRUE(plan.ready());
+    EXPECT_EQ(plan.stepCount(), 3000u);
+    static_assert(noexcept(plan.execute()), "plan execution must not throw");
+
+    plan.setFlow(info.feeds[0], 123.0);
+    fs.stream(info.feeds[0]).setMassFlow(123.0);
+    plan.execute();
+    fs.run();
+    for (StreamId id = 0; id < fs.getStreams().size(); id++)
+        EXPECT_EQ(plan.flow(id), fs.stream(id).getMassFlow());
+
+    for (auto& s : fs.getStreams()) s->setMassFlow(0.0);
+    plan.store();
+    EXPECT_EQ(fs.stream(info.products[0]).getMassFlow(), plan.flow(info.products[0]));
+}
+
+TEST(FlowsheetPlanUnit, ReportsEveryProblem) {
+    Flowsheet fs;
+    StreamId a = fs.newStream(1.0), b = fs.newStream(), c = fs.newStream(), d = fs.newStream();
+    Mixer& mx = fs.newMixer(2);                         // 0: нет входов
+    fs.connectOutput(mx, b);
+    Reactor& rx = fs.newReactor(true);                  // 1: один выход из двух
+    fs.connectInput(rx, b); fs.connectOutput(rx, c);
+    Reactor& dup = fs.newReactor(false);                // 2: второй производитель c
+    fs.connectInput(dup, a); fs.connectOutput(dup, c);
+    auto dbl = std::make_shared<DoublingMixer>();       // 3: неподдерживаемый вид
+    dbl->addInput(fs.getStreams()[a]); dbl->addOutput(fs.getStreams()[d]);
+    fs.addDevice(dbl);
+    auto loopA = fs.newStream(), loopB = fs.newStream();
+    Reactor& r1 = fs.newReactor(false);                 // 4, 5: рецикл
+    fs.connectInput(r1, loopB); fs.connectOutput(r1, loopA);
+    Reactor& r2 = fs.newReactor(false);
+    fs.connectInput(r2, loopA); fs.connectOutput(r2, loopB);
+
+    FlowsheetPlan plan;
+    auto errors = plan.compile(fs);
+    EXPECT_FALSE(plan.ready());
+    std::vector<std::pair<PlanErrorKind, size_t>> found;
+    for (const auto& e : errors) found.push_back({e.kind, e.device});
+    auto has = [&](PlanErrorKind k, size_t dev) {
+        return std::find(found.begin(), found.end(), std::make_pair(k, dev)) != found.end();
+    };
+    EXPECT_TRUE(has(PlanErrorKind::InputCount, 0));
+    EXPECT_TRUE(has(PlanErrorKind::OutputCount, 1));
+    EXPECT_TRUE(has(PlanErrorKind::SeveralProducers, 2));
+    EXPECT_TRUE(has(PlanErrorKind::UnsupportedDevice, 3));
+    EXPECT_TRUE(has(PlanErrorKind::RecycleLoop, 4));
+    EXPECT_TRUE(has(PlanErrorKind::RecycleLoop, 5));
+    EXPECT_EQ(errors.size(), 6u);
+    for (const auto& e : errors) EXPECT_FALSE(e.message.empty());
+}
+
+TEST(FlowsheetPlanUnit, MixerMayUseFewerInputsThanItsLimit) {
+    Flowsheet fs;
+    StreamId a = fs.newStream(1.5), b = fs.newStream(2.0), out = fs.newStream();
+    Mixer& mx = fs.newMixer(4);
+    fs.connectInput(mx, a); fs.connectInput(mx, b); fs.connectOutput(mx, out);
+    FlowsheetPlan plan;
+    EXPECT_TRUE(plan.compile(fs).empty());
+    plan.execute();
+    fs.run();
+    EXPECT_EQ(plan.flow(out), fs.stream(out).getMassFlow());
+    EXPECT_DOUBLE_EQ(plan.flow(out), 3.5);
+}
+
+// ---------- Interned names ----------
+TEST(InternedNames, EqualNamesShareOneEntry) {
+    Stream a(1), b(2), c(3);
+    b.setName("feed");
+    c.setName("feed");
+    EXPECT_EQ(b.getNameId(), c.getNameId());
+    EXPECT_EQ(&GlobalNames::get(b.getNameId()), &GlobalNames::get(c.getNameId()));
+    EXPECT_EQ(a.getName(), "s1");
+    EXPECT_NE(a.getNameId() & GlobalNames::NUMBERED, 0u); // имя по умолчанию не интернируется
+    EXPECT_EQ(GlobalNames::find("no such name, surely"), UINT32_MAX);
+    EXPECT_EQ(GlobalNames::get(0), "");
+
+    Mixer mx(1);
+    EXPECT_EQ(mx.getName(), "");
+    mx.setName("M-101");
+    EXPECT_EQ(mx.getName(), "M-101");
+}
+
+TEST(InternedNames, DefaultNamesStayOutOfGlobalPool) {
+    const size_t before = GlobalNames::size();
+    {
+        Flowsheet fs;
+        for (int i = 0; i < 1000; i++) fs.newStream(1.0);
+        EXPECT_EQ(fs.findStream("s1000"), 999u);
+        StreamTable t;
+        fs.loadTable(t);
+        EXPECT_EQ(t.getName(41), "s42");
+    }
+    EXPECT_EQ(GlobalNames::size(), before);
+}
+
+TEST(InternedNames, NumberedParsesOnlyDefaultNames) {
+    EXPECT_EQ(GlobalNames::numbered("s42"), GlobalNames::NUMBERED | 42u);
+    EXPECT_EQ(GlobalNames::numbered("s0"), GlobalNames::NUMBERED);
+    EXPECT_EQ(GlobalNames::numbered("s042"), 0u);
+    EXPECT_EQ(GlobalNames::numbered("s-1"), 0u);
+    EXPECT_EQ(GlobalNames::numbered("s"), 0u);
+    EXPECT_EQ(GlobalNames::numbered("feed"), 0u);
+    EXPECT_EQ(GlobalNames::numbered("s2147483648"), 0u);
+}
+
+TEST(InternedNames, FlowsheetFindsStreamsAndDevicesByName) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(5.0), out = fs.newStream();
+    Reactor& rx = fs.newReactor(false);
+    fs.connectInput(rx, feed); fs.connectOutput(rx, out);
+    rx.setName("R-1");
+    fs.stream(out).setName("FI-200.PV");
+    fs.invalidate();                                    // переименование после добавления
+
+    EXPECT_EQ(fs.findStream("FI-200.PV"), out);
+    EXPECT_EQ(fs.findStream("s1"), feed);
+    EXPECT_EQ(fs.findStream("missing"), NO_STREAM);
+    EXPECT_EQ(fs.findDevice("R-1"), &rx);
+    EXPECT_EQ(fs.findDevice("R-2"), nullptr);
+
+    StreamId late = fs.newStream();                     // добавление сбрасывает индекс само
+    EXPECT_EQ(fs.findStream(fs.stream(late).getName()), late);
+}
+
+// ---------- Binary snapshots ----------
+TEST(SnapshotFormat, MappedSnapshotExecutesInPlaceAndLoads) {
+    GeneratorOptions opt;
+    opt.devices = 2000;
+    opt.seed = 5;
+    Flowsheet fs;
+    auto info = FlowsheetGenerator(opt).generate(fs);
+    fs.getDevices()[0]->setName("M-1");
+    const std::string path = ::testing::TempDir() + "flowsheet.snap";
+    FlowsheetSnapshot::write(fs, path);
+    fs.run();
+
+    FlowsheetSnapshot snap(path);
+    ASSERT_EQ(snap.deviceCount(), fs.getDevices().size());
+    ASSERT_EQ(snap.streamCount(), fs.getStreams().size());
+    EXPECT_EQ(snap.deviceName(0), "M-1");
+    EXPECT_EQ(snap.streamName(info.feeds[0]), fs.stream(info.feeds[0]).getName());
+    ASSERT_TRUE(snap.executable());
+    snap.execute();
+    for (StreamId id = 0; id < snap.streamCount(); id++)
+        EXPECT_EQ(snap.data()[id], fs.stream(id).getMassFlow());
+
+    Flowsheet copy;
+    const StreamId base = snap.load(copy);
+    EXPECT_EQ(base, 0u);
+    copy.run();
+    for (StreamId id = 0; id < snap.streamCount(); id++)
+        EXPECT_EQ(copy.stream(id).getMassFlow(), fs.stream(id).getMassFlow());
+    EXPECT_EQ(copy.findDevice("M-1"), copy.getDevices()[0].get());
+
+    FlowsheetSnapshot again(path);                      // изменения на месте не попали в файл
+    EXPECT_EQ(again.data()[info.products[0]], 0.0);
+}
+
+TEST(SnapshotFormat, LoadKeepsDefaultNamesOutOfGlobalPool) {
+    GeneratorOptions opt;
+    opt.devices = 500;
+    opt.seed = 7;
+    Flowsheet fs;
+    FlowsheetGenerator(opt).generate(fs);
+    fs.stream(0).setName("feed-A");
+    const std::string path = ::testing::TempDir() + "unnamed.snap";
+    FlowsheetSnapshot::write(fs, path);
+
+    const size_t before = GlobalNames::size();
+    FlowsheetSnapshot snap(path);
+    Flowsheet copy;
+    snap.load(copy);
+    EXPECT_EQ(GlobalNames::size(), before);
+    for (StreamId id = 0; id < snap.streamCount(); id++)
+        EXPECT_EQ(copy.stream(id).getName(), fs.stream(id).getName());
+    EXPECT_EQ(copy.findStream("feed-A"), 0u);
+}
+
+TEST(SnapshotFormat, RecycleSnapshotIsLoadableButNotExecutable) {
+    RecycleLoop loop;
+    const std::string path = ::testing::TempDir() + "recycle.snap";
+    FlowsheetSnapshot::write(loop.fs, path);
+    FlowsheetSnapshot snap(path);
+    EXPECT_FALSE(snap.executable());
+    Flowsheet copy;
+    snap.load(copy);
+    EXPECT_TRUE(copy.solve().converged);
+    EXPECT_NEAR(copy.stream(copy.findStream(loop.product->getName())).getMassFlow(), 10.0, 1e-6);
+}
+
+TEST(SnapshotFormat, CorruptFilesAreRejected) {
+    const std::string path = ::testing::TempDir() + "corrupt.snap";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "definitely not a snapshot, but long enough to hold a header of the format....."
+               "......................................................................";
+    }
+    EXPECT_THROW(FlowsheetSnapshot{path}, std::string);
+    EXPECT_THROW(FlowsheetSnapshot{::testing::TempDir() + "missing.snap"}, std::string);
+
+    Flowsheet fs;
+    StreamId a = fs.newStream(1.0), b = fs.newStream();
+    auto dbl = std::make_shared<DoublingMixer>();
+    dbl->addInput(fs.getStreams()[a]); dbl->addOutput(fs.getStreams()[b]);
+    fs.addDevice(dbl);
+    EXPECT_THROW(FlowsheetSnapshot::write(fs, path), std::string);
+}
+
+// ---------- Text format ----------
+TEST(TextFormat, ParsesDevicesStreamsAndComments) {
+    std::istringstream text(
+        "# two feeds into a mixer, then a splitting reactor\r\n"
+        "stream feedA 10\n"
+        "stream\tfeedB 2.5   # inline comment\n"
+        "\n"
+        "mixer M1 feedA feedB -> mixed\n"
+        "reactor R1 mixed -> top bottom\n");
+    Flowsheet fs;
+    FlowsheetTextReader reader(fs, 16);                 // маленький блок: строки пересекают границы
+    EXPECT_EQ(reader.read(text), 6u);
+    ASSERT_EQ(fs.getDevices().size(), 2u);
+    EXPECT_EQ(fs.getDevices()[0]->getName(), "M1");
+    EXPECT_EQ(fs.getDevices()[1]->outputsView().size(), 2u);
+    fs.run();
+    EXPECT_DOUBLE_EQ(fs.stream(reader.stream("top")).getMassFlow(), 6.25);
+    EXPECT_EQ(fs.findDevice("R1"), fs.getDevices()[1].get());
+    EXPECT_EQ(reader.stream("nope"), NO_STREAM);
+}
+
+static FlowsheetParseError parseError(const std::string& source) {
+    std::istringstream text(source);
+    Flowsheet fs;
+    try {
+        FlowsheetTextReader(fs).read(text);
+    } catch (const FlowsheetParseError& e) {
+        return e;
+    }
+    return {0, 0, "no error"};
+}
+
+TEST(TextFormat, ErrorsPointAtLineAndColumn) {
+    auto e = parseError("stream a 1\n  mixr M a -> b\n");
+    EXPECT_EQ(e.line, 2u);
+    EXPECT_EQ(e.column, 3u);
+    EXPECT_EQ(e.what(), "2:3: Unknown keyword 'mixr'");
+
+    e = parseError("stream a 1x\n");
+    EXPECT_EQ(e.line, 1u); EXPECT_EQ(e.column, 10u);
+    e = parseError("mixer M a b\n");
+    EXPECT_EQ(e.line, 1u); EXPECT_EQ(e.column, 12u);        // после последней лексемы
+    e = parseError("reactor R a -> b c d\n");
+    EXPECT_EQ(e.column, 20u);
+    e = parseError("reactor R a -> b\nreactor R b -> c\n");
+    EXPECT_EQ(e.line, 2u); EXPECT_EQ(e.column, 9u);
+    e = parseError("reactor R1 a -> b\nmixer M a -> b\n");
+    EXPECT_EQ(e.line, 2u); EXPECT_EQ(e.column, 14u);        // второй производитель b
+    e = parseError("stream a 1\nstream a 2\n");
+    EXPECT_EQ(e.line, 2u); EXPECT_EQ(e.column, 8u);
+}
+
+TEST(TextFormat, WriteThenReadPreservesFlowsheet) {
+    GeneratorOptions opt;
+    opt.devices = 500;
+    Flowsheet fs;
+    FlowsheetGenerator(opt).generate(fs);
+    std::stringstream text;
+    writeFlowsheetText(fs, text);
+
+    Flowsheet copy;
+    FlowsheetTextReader(copy, 64).read(text);
+    ASSERT_EQ(copy.getStreams().size(), fs.getStreams().size());
+    ASSERT_EQ(copy.getDevices().size(), fs.getDevices().size());
+    fs.run();
+    copy.run();
+    for (StreamId id = 0; id < fs.getStreams().size(); id++)
+        EXPECT_EQ(copy.stream(id).getMassFlow(), fs.stream(id).getMassFlow());
+}
+
+TEST(TextFormat, PartiallyConnectedReactorIsNotWritten) {
+    Flowsheet fs;
+    StreamId a = fs.newStream(4.0), b = fs.newStream();
+    Reactor& rx = fs.newReactor(true);                  // два выхода, подключён один
+    fs.connectInput(rx, a); fs.connectOutput(rx, b);
+    std::stringstream text;
+    EXPECT_THROW(writeFlowsheetText(fs, text), std::string);
+
+    StreamId c = fs.newStream();
+    fs.connectOutput(rx, c);
+    std::stringstream full;
+    writeFlowsheetText(fs, full);
+    Flowsheet copy;
+    FlowsheetTextReader(copy, 64).read(full);
+    fs.run();
+    copy.run();
+    EXPECT_EQ(copy.stream(b).getMassFlow(), 2.0);
+    EXPECT_EQ(copy.stream(b).getMassFlow(), fs.stream(b).getMassFlow());
+}
+
+// ---------- Dynamic simulation ----------
+TEST(DynamicSimulation, TankFillsLikeFirstOrderLag) {
+    Flowsheet fs;
+    auto feed = fs.addStream(std::make_shared<Stream>(1));
+    auto out = fs.addStream(std::make_shared<Stream>(2));
+    feed->setMassFlow(2.0);
+    auto tank = std::make_shared<Tank>(1, 10.0);
+    tank->addInput(feed);
+    tank->addOutput(out);
+    fs.addDevice(tank);
+
+    const double exact = 20.0 * (1.0 - std::exp(-3.0));     // M(t) = F·τ·(1 − e^(−t/τ))
+    for (Integrator method : {Integrator::Euler, Integrator::RungeKutta4, Integrator::Adaptive23}) {
+        tank->setHoldup(0.0);
+        DynamicOptions opt;
+        opt.method = method;
+        opt.step = 0.1;
+        DynamicSimulator sim(fs, opt);
+        sim.advance(10.0);
+        sim.advance(20.0);
+        EXPECT_DOUBLE_EQ(sim.time(), 30.0);
+        EXPECT_NEAR(tank->getHoldup(), exact, method == Integrator::Euler ? 0.05 : 1e-4);
+        EXPECT_DOUBLE_EQ(out->getMassFlow(), tank->getHoldup() / 10.0);
+        if (method == Integrator::Adaptive23) {
+            EXPECT_LT(sim.report().steps, 300);
+        }
+    }
+}
+
+TEST(DynamicSimulation, RecycleThroughTankReachesSteadyState) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(1.0), mixed = fs.newStream(), held = fs.newStream();
+    StreamId product = fs.newStream(), back = fs.newStream();
+    Mixer& mixer = fs.newMixer(2);
+    fs.connectInput(mixer, feed); fs.connectInput(mixer, back); fs.connectOutput(mixer, mixed);
+    auto tank = std::make_shared<Tank>(1, 5.0);
+    fs.connectInput(*tank, mixed); fs.connectOutput(*tank, held);
+    fs.addDevice(tank);
+    Reactor& reactor = fs.newReactor(true);
+    fs.connectInput(reactor, held); fs.connectOutput(reactor, product); fs.connectOutput(reactor, back);
+
+    DynamicOptions opt;
+    opt.method = Integrator::Adaptive23;
+    DynamicSimulator sim(fs, opt);
+    EXPECT_EQ(sim.stateCount(), 1u);
+    sim.advance(500.0);
+    EXPECT_NEAR(tank->getHoldup(), 10.0, 1e-4);             // выход ёмкости 2F, запас 2F·τ
+    EXPECT_NEAR(fs.stream(product).getMassFlow(), 1.0, 1e-5);
+    EXPECT_GT(sim.currentStep(), 1.0);                      // вблизи стационара шаг растёт
+}
+
+TEST(DynamicSimulation, RecycleThroughTankFollowsTransient) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(1.0), mixed = fs.newStream(), held = fs.newStream();
+    StreamId product = fs.newStream(), back = fs.newStream();
+    Reactor& reactor = fs.newReactor(true);                 // потребитель ёмкости добавлен раньше неё
+    fs.connectInput(reactor, held); fs.connectOutput(reactor, product); fs.connectOutput(reactor, back);
+    Mixer& mixer = fs.newMixer(2);
+    fs.connectInput(mixer, feed); fs.connectInput(mixer, back); fs.connectOutput(mixer, mixed);
+    auto tank = std::make_shared<Tank>(1, 5.0);
+    fs.connectInput(*tank, mixed); fs.connectOutput(*tank, held);
+    fs.addDevice(tank);
+
+    DynamicOptions opt;
+    opt.step = 0.1;
+    DynamicSimulator sim(fs, opt);
+    sim.advance(10.0);
+    EXPECT_NEAR(tank->getHoldup(), 10.0 * (1.0 - std::exp(-1.0)), 1e-8); // M' = F − M/(2τ)
+    EXPECT_DOUBLE_EQ(fs.stream(held).getMassFlow(), tank->getHoldup() / 5.0);
+
+    tank->setHoldup(10.0);                                  // стационар: один шаг Эйлера его не сдвигает
+    opt.method = Integrator::Euler;
+    opt.step = 1.0;
+    DynamicSimulator euler(fs, opt);
+    euler.advance(1.0);
+    EXPECT_DOUBLE_EQ(tank->getHoldup(), 10.0);
+}
+
+TEST(DynamicSimulation, BoundaryFollowsModelTime) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(), out = fs.newStream();
+    auto tank = std::make_shared<Tank>(1, 1.0);
+    fs.connectInput(*tank, feed); fs.connectOutput(*tank, out);
+    fs.addDevice(tank);
+
+    DynamicOptions opt;
+    opt.step = 0.01;
+    DynamicSimulator sim(fs, opt);
+    sim.advance(5.0, [&](double t) { fs.stream(feed).setMassFlow(t); });
+    EXPECT_NEAR(tank->getHoldup(), 4.0 + std::exp(-5.0), 1e-8); // M' = t − M
+    EXPECT_DOUBLE_EQ(fs.stream(feed).getMassFlow(), 5.0);
+}
+
+TEST(DynamicSimulation, RejectsLoopsWithoutHoldupAndBadOptions) {
+    Flowsheet fs;
+    StreamId feed = fs.newStream(1.0), mixed = fs.newStream(), product = fs.newStream(), back = fs.newStream();
+    Mixer& mixer = fs.newMixer(2);
+    fs.connectInput(mixer, feed); fs.connectInput(mixer, back); fs.connectOutput(mixer, mixed);
+    Reactor& reactor = fs.newReactor(true);
+    fs.connectInput(reactor, mixed); fs.connectOutput(reactor, product); fs.connectOutput(reactor, back);
+    EXPECT_THROW(DynamicSimulator{fs}, std::string);
+
+    Flowsheet empty;
+    DynamicOptions opt;
+    opt.step = 0.0;
+    EXPECT_THROW(DynamicSimulator(empty, opt), std::string);
+    EXPECT_THROW(Tank(1, 0.0), std::string);
+}
+
+// ---------- Real-time loop ----------
+TEST(RealtimeLoopUnit, CyclesMatchPlanAndTrackLatency) {
+    Flowsheet fs;
+    StreamId a = fs.newStream(1.0), b = fs.newStream(2.0), mixed = fs.newStream(), top = fs.newStream(), bottom = fs.newStream();
+    Mixer& mixer = fs.newMixer(2);
+    fs.connectInput(mixer, a); fs.connectInput(mixer, b); fs.connectOutput(mixer, mixed);
+    Reactor& reactor = fs.newReactor(true);
+    fs.connectInput(reactor, mixed); fs.connectOutput(reactor, top); fs.connectOutput(reactor, bottom);
+    FlowsheetPlan plan;
+    ASSERT_TRUE(plan.compile(fs).empty());
+
+    RealtimeLoop loop(plan, {a, b}, {top, bottom}, std::chrono::seconds(1));
+    EXPECT_EQ(loop.stats().cycles, 0u);                     // прогрев не учитывается
+    EXPECT_DOUBLE_EQ(loop.outputs()[0], 1.5);
+    for (int i = 0; i < 100; i++) {
+        loop.feeds()[0] = i;
+        EXPECT_TRUE(loop.cycle());
+        EXPECT_DOUBLE_EQ(loop.outputs()[1], (i + 2.0) / 2);
+    }
+    const RealtimeStats s = loop.stats();
+    EXPECT_EQ(s.cycles, 100u);
+    EXPECT_EQ(s.overruns, 0u);
+    EXPECT_LE(s.lastNs, s.worstNs);
+    EXPECT_LE(s.meanNs, s.worstNs);
+    EXPECT_GE(loop.latencyBound(1.0), s.worstNs);
+    EXPECT_LE(loop.latencyBound(0.5), loop.latencyBound(1.0));
+}
+
+TEST(RealtimeLoopUnit, CountsOverrunsAndRejectsBadSetup) {
+    Flowsheet fs;
+    StreamId in = fs.newStream(4.0), out = fs.newStream();
+    Reactor& reactor = fs.newReactor(false);
+    fs.connectInput(reactor, in); fs.connectOutput(reactor, out);
+    FlowsheetPlan plan;
+    EXPECT_THROW(RealtimeLoop(plan, {in}, {out}), std::string); // план не собран
+    ASSERT_TRUE(plan.compile(fs).empty());
+    EXPECT_THROW(RealtimeLoop(plan, {in}, {99}), std::string);
+
+    RealtimeLoop loop(plan, {in}, {out}, std::chrono::nanoseconds(0));
+    for (int i = 0; i < 10; i++) loop.cycle();
+    EXPECT_EQ(loop.stats().overruns, 10u);                 // нулевой бюджет превышает любой цикл
+    loop.resetStats();
+    EXPECT_EQ(loop.stats().cycles, 0u);
+    EXPECT_EQ(loop.latencyBound(0.99), 0.0);
+}
+
+// ---------- Hot-path allocations ----------
+TEST(HotPathAllocations, CounterSeesAllocations) {
+    Mixer mixer(2);
+    mixer.addInput(std::make_shared<Stream>(1));
+    AllocationCounter allocations;
+    auto copy = mixer.getInputs();                          // копия вектора выделяет память
+    EXPECT_GE(allocations.count(), 1u);
+}
+
+TEST(HotPathAllocations, PooledPortsSkipRefcountAndHeap) {
+    Flowsheet fs;
+    Mixer& mx = fs.newMixer(3);
+    StreamId a = fs.newStream(1.0), b = fs.newStream(2.0), c = fs.newStream(3.0), out = fs.newStream();
+    const long owners = fs.getStreams()[a].use_count();
+    AllocationCounter allocations;
+    fs.connectInput(mx, a); fs.connectInput(mx, b); fs.connectInput(mx, c);
+    fs.connectOutput(mx, out);
+    EXPECT_EQ(allocations.count(), 0u);                     // порты хранятся в самом устройстве
+    EXPECT_EQ(fs.getStreams()[a].use_count(), owners);      // и не трогают счётчик ссылок пула
+    EXPECT_EQ(mx.inputsView()[2], &fs.stream(c));
+    EXPECT_EQ(mx.getInputs()[0].use_count(), 0);            // невладеющий указатель на поток пула
+}
+
+TEST(HotPathAllocations, DeviceUpdatesDoNotAllocate) {
+    auto a = std::make_shared<Stream>(1), b = std::make_shared<Stream>(2);
+    auto mixed = std::make_shared<Stream>(3), top = std::make_shared<Stream>(4), bottom = std::make_shared<Stream>(5);
+    a->setComponentFlows({1.0, 2.0, 0.0});
+    b->setComponentFlows({0.5, 0.0, 1.0});
+    Mixer mixer(2);
+    mixer.addInput(a); mixer.addInput(b); mixer.addOutput(mixed);
+    Reactor reactor(true);
+    reactor.addInput(mixed); reactor.addOutput(top); reactor.addOutput(bottom);
+    reactor.setReactions(3, {-1.0, 1.0, 0.0}, {0}, {0.5});
+    mixer.updateOutputs();                                  // первый пересчёт задаёт размер составов
+    reactor.updateOutputs();
+
+    AllocationCounter allocations;
+    for (int i = 0; i < 100; i++) {
+        a->setMassFlow(i + 1.0);
+        mixer.updateOutputs();
+        reactor.updateOutputs();
+    }
+    EXPECT_EQ(allocations.count(), 0u);
+}
+
+TEST(HotPathAllocations, FlowsheetSolvesDoNotAllocate) {
+    GeneratorOptions opt;
+    opt.devices = 300;
+    Flowsheet acyclic;
+    const GeneratedFlowsheet info = FlowsheetGenerator(opt).generate(acyclic);
+    StreamTable table;
+    acyclic.run();
+    acyclic.update();
+    acyclic.loadTable(table);
+    acyclic.runTable(table);
+
+    opt.recycleDensity = 0.2;
+    Flowsheet recycle;
+    const GeneratedFlowsheet loops = FlowsheetGenerator(opt).generate(recycle);
+    ASSERT_FALSE(loops.recycles.empty());
+    LinearFlowsheetSolver linear;
+    linear.analyze(recycle);
+    for (RecycleMethod m : {RecycleMethod::DirectSubstitution, RecycleMethod::Wegstein, RecycleMethod::Anderson}) {
+        RecycleOptions ro;
+        ro.method = m;
+        recycle.solve(ro);
+
+        AllocationCounter allocations;
+        for (int i = 0; i < 3; i++) {
+            recycle.stream(loops.feeds[0]).setMassFlow(10.0 + i);
+            recycle.solve(ro);
+        }
+        EXPECT_EQ(allocations.count(), 0u) << "method " << static_cast<int>(m);
+    }
+
+    AllocationCounter allocations;
+    for (int i = 0; i < 10; i++) {
+        acyclic.stream(info.feeds[0]).setMassFlow(i);
+        acyclic.run();
+        acyclic.stream(info.feeds[1]).setMassFlow(i);
+        acyclic.update();
+        acyclic.runTable(table);
+        linear.solve();
+    }
+    EXPECT_EQ(allocations.count(), 0u);
+}
+
+TEST(HotPathAllocations, PlansRealtimeAndDynamicLoopsDoNotAllocate) {
+    GeneratorOptions opt;
+    opt.devices = 300;
+    Flowsheet fs;
+    const GeneratedFlowsheet info = FlowsheetGenerator(opt).generate(fs);
+    FlowsheetPlan plan;
+    ASSERT_TRUE(plan.compile(fs).empty());
+    RealtimeLoop loop(plan, info.feeds, info.products);
+
+    Flowsheet dyn;
+    StreamId feed = dyn.newStream(1.0), mixed = dyn.newStream(), held = dyn.newStream();
+    StreamId product = dyn.newStream(), back = dyn.newStream();
+    Mixer& mixer = dyn.newMixer(2);
+    dyn.connectInput(mixer, feed); dyn.connectInput(mixer, back); dyn.connectOutput(mixer, mixed);
+    auto tank = std::make_shared<Tank>(1, 5.0);
+    dyn.connectInput(*tank, mixed); dyn.connectOutput(*tank, held);
+    dyn.addDevice(tank);
+    Reactor& reactor = dyn.newReactor(true);
+    dyn.connectInput(reactor, held); dyn.connectOutput(reactor, product); dyn.connectOutput(reactor, back);
+    DynamicSimulator fixed(dyn);
+    DynamicOptions adaptive;
+    adaptive.method = Integrator::Adaptive23;
+    DynamicSimulator variable(dyn, adaptive);
+
+    AllocationCounter allocations;
+    for (int i = 0; i < 100; i++) {
+        plan.setFlow(info.feeds[0], i);
+        plan.execute();
+        loop.feeds()[0] = i;
+        loop.cycle();
+    }
+    fixed.advance(100.0);
+    variable.advance(100.0, [&](double t) { dyn.stream(feed).setMassFlow(t < 50.0 ? 1.0 : 2.0); });
+    EXPECT_EQ(allocations.count(), 0u);
+}